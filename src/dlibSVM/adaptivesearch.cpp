@@ -0,0 +1,93 @@
+#include "adaptivesearch.h"
+
+SearchResult goldenSectionSearch (std::function<double (double)> f,
+                                  double logLo, double logHi,
+                                  double tol, uint maxEvals)
+{
+    const double invphi = (std::sqrt (5.0) - 1.0) / 2.0;
+    std::map<double, double> seen;
+    SearchResult res;
+    auto eval = [&] (double x)
+    {
+        if (seen.count (x) == 0)
+        {
+            seen[x] = f (std::pow (10.0, x));
+            res.evaluations++;
+        }
+        if (seen[x] > res.score)
+        {
+            res.score = seen[x];
+            res.C1 = res.C2 = std::pow (10.0, x);
+        }
+        return seen[x];
+    };
+
+    double a = logLo, b = logHi;
+    double x1 = b - invphi * (b - a), x2 = a + invphi * (b - a);
+    double f1 = eval (x1), f2 = eval (x2);
+    while (b - a > tol && res.evaluations < maxEvals)
+    {
+        if (f1 >= f2)
+        {
+            b = x2;
+            x2 = x1;
+            f2 = f1;
+            x1 = b - invphi * (b - a);
+            f1 = eval (x1);
+        }
+        else
+        {
+            a = x1;
+            x1 = x2;
+            f1 = f2;
+            x2 = a + invphi * (b - a);
+            f2 = eval (x2);
+        }
+    }
+    return res;
+}
+
+SearchResult patternSearch (std::function<double (double, double)> f,
+                            double logC1, double logC2, double step,
+                            double tol, uint maxEvals)
+{
+    std::map<std::pair<double, double>, double> seen;
+    SearchResult res;
+    auto eval = [&] (double x, double y)
+    {
+        std::pair<double, double> k (x, y);
+        if (seen.count (k) == 0)
+        {
+            seen[k] = f (std::pow (10.0, x), std::pow (10.0, y));
+            res.evaluations++;
+        }
+        return seen[k];
+    };
+
+    double x = logC1, y = logC2;
+    double best = eval (x, y);
+    const double dx[4] = {1, -1, 0, 0};
+    const double dy[4] = {0, 0, 1, -1};
+    while (step > tol && res.evaluations < maxEvals)
+    {
+        double bx = x, by = y;
+        for (int k = 0; k < 4 && res.evaluations < maxEvals; k++)
+        {
+            double v = eval (x + dx[k] * step, y + dy[k] * step);
+            if (v > best)
+            {
+                best = v;
+                bx = x + dx[k] * step;
+                by = y + dy[k] * step;
+            }
+        }
+        if (bx == x && by == y)
+            step /= 2;
+        x = bx;
+        y = by;
+    }
+    res.C1 = std::pow (10.0, x);
+    res.C2 = std::pow (10.0, y);
+    res.score = best;
+    return res;
+}
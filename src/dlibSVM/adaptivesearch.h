@@ -0,0 +1,40 @@
+#ifndef ADAPTIVESEARCH_H
+#define ADAPTIVESEARCH_H
+
+#include <iostream>
+#include <functional>
+#include <map>
+#include <cmath>
+
+typedef unsigned int uint;
+
+/* Derivative free maximizers used to search the SVM C parameters
+ *
+ * Both work on log10(C), since cross validation accuracy changes on a log
+ * scale of C, and memoize the objective so no point is evaluated twice.
+ * - goldenSectionSearch : 1-D, single C for both classes. Assumes the
+ *                         accuracy is unimodal inside the bracket.
+ * - patternSearch :       2-D compass search over (C1, C2). Polls the four
+ *                         axis neighbours at the current step, moves to the
+ *                         best improving one, halves the step otherwise.
+ * Both stop when the bracket / step gets below 'tol' (in decades) or after
+ * 'maxEvals' evaluations of the objective, whichever comes first.
+*/
+struct SearchResult
+{
+    SearchResult () : C1(0), C2(0), score(-1), evaluations(0) {}
+
+    double C1;
+    double C2;
+    double score;
+    uint evaluations;
+};
+
+SearchResult goldenSectionSearch (std::function<double (double)> f,
+                                  double logLo, double logHi,
+                                  double tol, uint maxEvals);
+SearchResult patternSearch (std::function<double (double, double)> f,
+                            double logC1, double logC2, double step,
+                            double tol, uint maxEvals);
+
+#endif // ADAPTIVESEARCH_H
@@ -0,0 +1,69 @@
+#include "cascade.h"
+#include <algorithm>
+
+void CascadeScorer::build (const vecD_t &w_, double bias_, const vecS_t &train,
+                           const vec<size_t> &f, double clip)
+{
+    assert (w_.size () == f.size () && train.size () > 0);
+    const size_t d = f.size ();
+    bias = bias_;
+    exactBound = clip > 0;
+    vecD_t range (d, 0.0);
+    if (exactBound)
+        range.assign (d, clip);
+    else
+        for (size_t i = 0; i < train.size (); i++)
+            for (size_t j = 0; j < d; j++)
+                range[j] = std::max (range[j], (double) std::fabs (train[i][f[j]]));
+
+    vec<size_t> order (d);
+    for (size_t j = 0; j < d; j++)
+        order[j] = j;
+    std::stable_sort (order.begin (), order.end (), [&] (size_t a, size_t b)
+                      { return std::fabs (w_[a]) * range[a] > std::fabs (w_[b]) * range[b]; });
+    w.resize (d);
+    col.resize (d);
+    off.assign (d, 0.0);
+    scale.assign (d, 1.0);
+    rem.assign (d + 1, 0.0);
+    for (size_t k = 0; k < d; k++)
+    {
+        w[k] = w_[order[k]];
+        col[k] = f[order[k]];
+        if (mu.size () > 0)
+        {
+            off[k] = mu[col[k]];
+            scale[k] = prec[col[k]];
+        }
+    }
+    for (size_t k = d; k-- > 0; )
+        rem[k] = rem[k + 1] + std::fabs (w[k]) * range[order[k]];
+}
+
+/// Partial scores of 'x' decided against 'threshold', returns the number of
+/// features visited over all samples
+size_t CascadeScorer::scores (const vecS_t &x, double threshold, vecD_t &s) const
+{
+    const size_t d = w.size ();
+    s.resize (x.size ());
+    vec<uint32_t> touched (x.size ());
+    TaskPool::instance ().parallelFor ("cascade scores", 0, x.size (), 0, [&] (size_t i) {
+        const sample_t &xi = x[i];
+        double f = bias;
+        size_t k = 0;
+        while (k < d)
+        {
+            size_t e = std::min (d, k + block);
+            for (; k < e; k++)
+                f += w[k] * (xi[col[k]] - off[k]) * scale[k];
+            if (std::fabs (f - threshold) > rem[k])
+                break;
+        }
+        s[i] = f;
+        touched[i] = k;
+    });
+    size_t total = 0;
+    for (size_t i = 0; i < touched.size (); i++)
+        total += touched[i];
+    return total;
+}
@@ -0,0 +1,58 @@
+#ifndef CASCADE_H
+#define CASCADE_H
+
+#include <vector>
+#include "datahandler.h"
+
+/* Early-exit scoring of a linear model f(z) = w' z + bias
+ *
+ * Features are visited in decreasing order of |w_j| R_j, R_j the largest
+ * |z_j| of the (normalized) training set, i.e. the most a feature can move
+ * the score. After every block of features the partial score s is compared
+ * with the bound on what the unvisited features can still add,
+ *
+ *      rem = sum over unvisited j of |w_j| R_j
+ *
+ * and once |s - threshold| > rem the side of the threshold is decided and
+ * the sample is done. The returned score is the partial one: its side of the
+ * threshold is the one of the full score, its value is not.
+ *
+ * The decision is exact for every sample whose features lie within the
+ * training range. With clipping ([data] Clip, c) R_j = c bounds every sample
+ * and the decisions are exact, period.
+ *
+ * With setInputNormalization the samples are raw, z_j = (x_j - mu_j) prec_j
+ * is computed only for the visited features.
+ *
+ * Usage:
+ *      CascadeScorer cs;
+ *      cs.build (w, bias, trainSet, featureSet, clip);
+ *      size_t touched = cs.scores (testSet, threshold, scores);
+*/
+class CascadeScorer
+{
+public:
+    CascadeScorer () : block(4), bias(0), exactBound(false) {}
+    void setBlock (size_t b) { block = std::max ((size_t) 1, b); }
+    void setInputNormalization (const vecD_t &mu_, const vecD_t &prec_)
+    { mu = mu_; prec = prec_; }
+    void build (const vecD_t &w_, double bias_, const vecS_t &train,
+                const vec<size_t> &f, double clip);
+    size_t scores (const vecS_t &x, double threshold, vecD_t &s) const;
+    size_t dimension () const { return w.size (); }
+    bool exact () const { return exactBound; }
+
+private:
+    size_t block;
+    double bias;
+    bool exactBound;
+    vecD_t w;           // weights in visiting order
+    vec<size_t> col;    // sample column of every visited feature
+    vecD_t off;         // subtracted before scaling (mu, 0 if normalized)
+    vecD_t scale;       // prec (1 if normalized)
+    vecD_t rem;         // rem[k]: bound of features k, k + 1, ...
+    vecD_t mu;
+    vecD_t prec;
+};
+
+#endif // CASCADE_H
@@ -0,0 +1,108 @@
+#include "cvcache.h"
+#include <iomanip>
+#include <limits>
+#include <cstdio>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+
+/// Use (and create) directory 'dir_' for the entries, an empty name disables
+/// the cache
+bool CVCache::open (const Str_t &dir_)
+{
+    dir.clear ();
+    if (dir_.size () == 0)
+        return false;
+    if (mkdir (dir_.c_str (), 0755) != 0 && errno != EEXIST)
+    {
+        std::cout << "Cannot create cache directory " << dir_ << "\n";
+        return false;
+    }
+    dir = dir_;
+    return true;
+}
+
+/// FNV-1a
+uint64_t CVCache::hash (const Str_t &s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size (); i++)
+        h = (h ^ (unsigned char) s[i]) * 1099511628211ULL;
+    return h;
+}
+
+Str_t CVCache::path (const Str_t &key) const
+{
+    std::stringstream ss;
+    ss << dir << '/' << std::hex << std::setw (16) << std::setfill ('0')
+       << hash (key) << ".cv";
+    return ss.str ();
+}
+
+/// Fields of the entry of 'key', false (a miss) if there is none, it has
+/// another format or lacks one of the 'required' fields
+bool CVCache::get (const Str_t &key, CVRecord &fields,
+                   const std::vector<Str_t> &required)
+{
+    if (!enabled ())
+        return false;
+    std::ifstream f (path (key).c_str ());
+    Str_t stored;
+    int format = 0;
+    size_t nfields = 0;
+    fields.clear ();
+    bool ok = f.is_open () && (f >> format) && format == FORMAT &&
+              f.ignore (std::numeric_limits<std::streamsize>::max (), '\n') &&
+              std::getline (f, stored) && stored == key && (f >> nfields);
+    for (size_t k = 0; ok && k < nfields; k++)
+    {
+        Str_t name;
+        size_t n = 0;
+        ok = static_cast<bool> (f >> name >> n);
+        vecD_t &v = fields[name];
+        v.resize (n);
+        for (size_t i = 0; ok && i < n; i++)
+            ok = static_cast<bool> (f >> v[i]);
+    }
+    for (size_t k = 0; ok && k < required.size (); k++)
+        ok = fields.count (required[k]) > 0;
+    if (!ok)
+    {
+        fields.clear ();
+        misses++;
+        return false;
+    }
+    hits++;
+    return true;
+}
+
+void CVCache::put (const Str_t &key, const CVRecord &fields) const
+{
+    if (!enabled ())
+        return;
+    Str_t final = path (key);
+    std::stringstream tmp;
+    tmp << final << ".tmp." << getpid () << '.' << std::this_thread::get_id ();
+    {
+        std::ofstream f (tmp.str ().c_str ());
+        if (!f.is_open ())
+            return;
+        f << FORMAT << "\n" << key << "\n" << fields.size () << "\n"
+          << std::setprecision (std::numeric_limits<double>::max_digits10);
+        for (CVRecord::const_iterator it = fields.begin (); it != fields.end (); ++it)
+        {
+            f << it->first << " " << it->second.size () << "\n";
+            for (size_t i = 0; i < it->second.size (); i++)
+                f << it->second[i] << "\n";
+        }
+        if (!f.good ())
+        {
+            f.close ();
+            std::remove (tmp.str ().c_str ());
+            return;
+        }
+    }
+    if (std::rename (tmp.str ().c_str (), final.c_str ()) != 0)
+        std::remove (tmp.str ().c_str ());
+}
@@ -0,0 +1,64 @@
+#ifndef CVCACHE_H
+#define CVCACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <map>
+
+typedef std::string Str_t;
+typedef std::vector<double> vecD_t;
+typedef std::map<Str_t, vecD_t> CVRecord;
+
+/* Persistent memoization of experiment results, shared between processes
+ *
+ * Maps a key string (content hash of the dataset plus every parameter the
+ * result depends on) to a record of named fields (names without white
+ * space), each a vector of doubles.
+ * A reader looks its fields up by name, so fields added later do not shift
+ * the ones it knows, and an entry missing a field it needs reads as a miss
+ * (see CVCache::get). The first line of an entry is the format version,
+ * entries of another format are misses as well. Every entry is one small file
+ * in 'dir' named after the 64 bit hash of its key; the file repeats the key,
+ * so a hash collision reads as a miss. Entries are written to a temporary
+ * file that is then renamed over the final name, which is atomic on POSIX
+ * file systems: concurrent processes on one machine see either a complete
+ * entry or none, and racing writers of one key write the same values.
+ * get and put may be called from several threads at once, the hit and miss
+ * counters are atomic.
+ *
+ * Usage:
+ *      CVCache cache;
+ *      cache.open ("cache");
+ *      CVRecord r;
+ *      if (!cache.get (key, r, "acc")) { r["acc"] = compute (); cache.put (key, r); }
+*/
+class CVCache
+{
+public:
+    CVCache () : hits(0), misses(0) {}
+    bool open (const Str_t &dir_);
+    bool enabled () const { return dir.size () > 0; }
+    bool get (const Str_t &key, CVRecord &fields,
+              const std::vector<Str_t> &required = std::vector<Str_t> ());
+    bool get (const Str_t &key, CVRecord &fields, const Str_t &required)
+    { return get (key, fields, std::vector<Str_t> (1, required)); }
+    void put (const Str_t &key, const CVRecord &fields) const;
+    size_t getHits () const { return hits; }
+    size_t getMisses () const { return misses; }
+    static uint64_t hash (const Str_t &s);
+
+private:
+    static const int FORMAT = 2;
+    Str_t path (const Str_t &key) const;
+
+    Str_t dir;
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+};
+
+#endif // CVCACHE_H
@@ -26,3 +26,42 @@ void dataHandlerLabelsToDlib (const vec<sample_t> &h, vec<label_t> &l)
     }
     assert (h.size () == l.size ());
 }
+
+/// Copy the features listed in 'f' of every sample into a row-major matrix
+void dataHandlerToRowMajor (const vec<sample_t> &h, const vec<size_t> &f,
+                            FeatureMatrix &m)
+{
+    assert (h.size () > 0 && f.size () > 0);
+    m.set_size (h.size (), f.size ());
+    for (size_t i = 0; i < h.size (); i++)
+    {
+        feature_t *r = m.row (i);
+        for (size_t j = 0; j < f.size (); j++)
+            r[j] = h[i][f[j]];
+    }
+}
+
+/// Sparse counterpart of dataHandlerToRowMajor for sparse hashed rows of
+/// 'numCols' columns: column f[j] of a row becomes column j of 'm'
+void dataHandlerToSparse (const vec<sample_t> &h, const vec<size_t> &f,
+                          size_t numCols, SparseFeatureMatrix &m)
+{
+    assert (h.size () > 0 && f.size () > 0);
+    const uint32_t NONE = (uint32_t) -1;
+    vec<uint32_t> pos (numCols, NONE);
+    for (size_t j = 0; j < f.size (); j++)
+        pos[f[j]] = (uint32_t) j;
+    m = SparseFeatureMatrix ();
+    m.nc = f.size ();
+    m.ptr.reserve (h.size () + 1);
+    for (size_t i = 0; i < h.size (); i++)
+    {
+        for (size_t k = 0; k < h[i].idx.size (); k++)
+            if (pos[h[i].idx[k]] != NONE)
+            {
+                m.idx.push_back (pos[h[i].idx[k]]);
+                m.val.push_back (h[i][k]);
+            }
+        m.ptr.push_back (m.idx.size ());
+    }
+}
@@ -18,7 +18,64 @@ typedef vec<double> vecD;
 typedef mat<double> matD;
 typedef unsigned int uint;
 
+/* Dense row-major matrix. Row 'i' occupies the contiguous range
+ * data[i * nc, (i + 1) * nc), so a whole training set is one allocation and
+ * solvers can stream over it without chasing per-sample pointers.
+ *
+ * FeatureMatrix stores samples in feature_t (float with FEATURE_FLOAT),
+ * ScoreMatrix holds weights and scores, which are always double.
+*/
+template <typename T>
+struct RowMajorMatrix
+{
+    RowMajorMatrix () : nr(0), nc(0) {}
+    inline void set_size (size_t r, size_t c) { nr = r; nc = c; data.assign (r * c, T (0)); }
+    inline T * row (size_t i) { return &data[i * nc]; }
+    inline const T * row (size_t i) const { return &data[i * nc]; }
+    inline T & operator() (size_t i, size_t j) { return data[i * nc + j]; }
+    inline const T & operator() (size_t i, size_t j) const { return data[i * nc + j]; }
+    inline size_t rows () const { return nr; }
+    inline size_t cols () const { return nc; }
+
+    vec<T> data;
+    size_t nr;
+    size_t nc;
+};
+
+typedef RowMajorMatrix<feature_t> FeatureMatrix;
+typedef RowMajorMatrix<double> ScoreMatrix;
+
+/* Sparse row-major (CSR) matrix of the sparse hashed rows: the non-zeros of
+ * row 'i' are val[ptr[i], ptr[i + 1]) in the columns idx[ptr[i], ptr[i + 1]).
+ * Solvers touch only the non-zeros of a row.
+*/
+struct SparseFeatureMatrix
+{
+    SparseFeatureMatrix () : nc(0) { ptr.push_back (0); }
+    inline size_t rows () const { return ptr.size () - 1; }
+    inline size_t cols () const { return nc; }
+    inline size_t begin (size_t i) const { return ptr[i]; }
+    inline size_t end (size_t i) const { return ptr[i + 1]; }
+    /// w' x_i for a dense w of cols () entries
+    inline double dot (size_t i, const double *w) const
+    {
+        double f = 0;
+        for (size_t k = ptr[i]; k < ptr[i + 1]; k++)
+            f += w[idx[k]] * val[k];
+        return f;
+    }
+
+    vec<size_t> ptr;
+    vec<uint32_t> idx;
+    vec<feature_t> val;
+    size_t nc;
+};
+
 void dataHandlerFeaturesToDlib (const vec<sample_t> &h, vec<matD> &l);
 void dataHandlerLabelsToDlib (const vec<sample_t> &h, vec<label_t> &l);
+void dataHandlerToRowMajor (const vec<sample_t> &h, const vec<size_t> &f,
+                            FeatureMatrix &m);
+void dataHandlerToSparse (const vec<sample_t> &h, const vec<size_t> &f,
+                          size_t numCols, SparseFeatureMatrix &m);
 
 #endif // DATACONVERTER_H
@@ -1,39 +1,114 @@
 #include "datahandler.h"
 
 
+bool DataHandler::robust = false;
+double DataHandler::clip = 0;
+bool DataHandler::rawTest = false;
+bool DataHandler::dedup = false;
+uint DataHandler::hashBits = 0;
+uint64_t DataHandler::hashSeed = 0;
+bool DataHandler::hashSparse = false;
+
+/// Robust (median / IQR) instead of standard scaling and, if 'clip_' > 0,
+/// clip normalized features to +-clip_, for every DataHandler created after
+void DataHandler::setScaling (bool robust_, double clip_)
+{
+    robust = robust_;
+    clip = clip_;
+}
+
+/// Keep the testing set of every DataHandler created after unnormalized
+/// (the training set, pool and statistics are unaffected)
+void DataHandler::setRawTest (bool raw)
+{
+    rawTest = raw;
+}
+
+/// Collapse duplicate rows of the training set of every DataHandler created
+/// after into weighted samples, before the statistics are computed
+void DataHandler::setDeduplicate (bool d)
+{
+    dedup = d;
+}
+
+/// Hash the 'index' of every index:value pair read after into one of
+/// 2^bits columns (0 bits: dense input), see hashFeature. 'sparse' stores
+/// the rows as (column, value) pairs.
+void DataHandler::setHashing (uint bits, uint64_t seed, bool sparse)
+{
+    assert (bits <= (sparse ? 22u : 16u) ||
+            !(std::cout << "Feature hashing supports at most 16 bits, 22 with sparse rows.\n"));
+    hashBits = bits;
+    hashSeed = seed;
+    hashSparse = sparse && bits > 0;
+}
+
+/* Column and sign of the raw feature index 's' (its 'n' bytes, so names work
+ * as well as numbers) in the hashed feature space: FNV-1a of the bytes
+ * started from the seed, then the MurmurHash3 finalizer to mix all bits. The
+ * low bits select the column, the top bit the sign, so collisions cancel out
+ * in expectation instead of adding up.
+*/
+double DataHandler::hashFeature (const char *s, size_t n, size_t &column)
+{
+    uint64_t h = 14695981039346656037ULL ^ hashSeed;
+    for (size_t b = 0; b < n; b++)
+        h = (h ^ (unsigned char) s[b]) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    column = h & (((uint64_t) 1 << hashBits) - 1);
+    return (h >> 63) ? -1.0 : 1.0;
+}
+
 DataHandler::DataHandler (const Str_t &filename) :
     DataHandler (filename, 1.0)
 {}
 
-DataHandler::DataHandler (const Str_t &filename, uint train_num_samples) :
+DataHandler::DataHandler (const Str_t &filename, uint train_num_samples,
+                          bool keep_pool, bool reservoir) :
     num_feat(0),
     samples(vecS_t ()),
+    keepPool(keep_pool),
     num_pos(0),
     num_neg(0),
-    num_train(0)
+    num_train(0),
+    endOffset(0)
 {
+    if (reservoir && train_num_samples > 0)
+    {
+        reservoirSample (filename, train_num_samples);
+        return;
+    }
     if (train_num_samples == 0) DataHandler(filename, 0.0);
     getData (filename);
     trainTestSplit (train_num_samples);
 }
 
-DataHandler::DataHandler (const Str_t &filename, double train_to_test_ratio) :
+DataHandler::DataHandler (const Str_t &filename, double train_to_test_ratio,
+                          bool keep_pool) :
     num_feat(0),
     samples(vecS_t ()),
+    keepPool(keep_pool),
     num_pos(0),
     num_neg(0),
-    num_train(0)
+    num_train(0),
+    endOffset(0)
 {
     getData (filename);
     trainTestSplit (train_to_test_ratio);
 }
 
-DataHandler::DataHandler (const Str_t &filename, const vecF_t &mu, const vecF_t &prec) :
+DataHandler::DataHandler (const Str_t &filename, const vecD_t &mu, const vecD_t &prec) :
     num_feat(0),
     samples(vecS_t ()),
+    keepPool(false),
     num_pos(0),
     num_neg(0),
-    num_train(0)
+    num_train(0),
+    endOffset(0)
 {
     assert (mu.size () > 0 && prec.size () > 0);
     trainMean = mu;
@@ -42,9 +117,207 @@ DataHandler::DataHandler (const Str_t &filename, const vecF_t &mu, const vecF_t
     trainTestSplit (0.0);
 }
 
+/// Testing mode on samples already parsed with readSamples (e.g. on another
+/// thread while the training data was processed). Takes over 'parsed'.
+DataHandler::DataHandler (vecS_t &parsed, const vecD_t &mu, const vecD_t &prec) :
+    num_feat(0),
+    samples(vecS_t ()),
+    keepPool(false),
+    num_pos(0),
+    num_neg(0),
+    num_train(0),
+    endOffset(0)
+{
+    assert (mu.size () > 0 && prec.size () > 0 && parsed.size () > 0);
+    printf ("********** DataHandler processing **********\n");
+    trainMean = mu;
+    trainPrec = prec;
+    samples.swap (parsed);
+    num_feat = numColumns (samples[0]);
+    countLabels ();
+    trainTestSplit (0.0);
+}
+
+DataHandler::DataHandler (const Str_t &filename, std::streamoff offset,
+                          const RunningMoments &moments, const vecS_t &retained,
+                          const FeatureQuantiles &quantiles) :
+    num_feat(0),
+    samples(vecS_t ()),
+    keepPool(false),
+    num_pos(0),
+    num_neg(0),
+    num_train(0),
+    trainTestRatio(1.0),
+    endOffset(0)
+{
+    printf ("********** DataHandler processing (incremental) **********\n");
+    num_feat = moments.mean.size ();
+    fileReader (filename, offset);
+    RunningMoments delta;
+    for (size_t i = 0; i < samples.size (); i++)
+        if (samples[i].getLabel () != 0)
+        {
+            trainSet.push_back (samples[i]);
+            delta.add (samples[i].getFeatures ());
+        }
+    samples.clear ();
+    printf ("- Number of new labelled samples: %lu\n", trainSet.size ());
+    trainMoments = moments;
+    trainMoments.merge (delta);
+    trainMoments.meanPrecision (trainMean, trainPrec);
+    printf ("- Merged training data statistics of %.0f samples.\n", trainMoments.n);
+    if (robust)
+    {
+        FeatureQuantiles q;
+        sketchSet (trainSet, q);
+        trainQuantiles = quantiles;
+        trainQuantiles.merge (q);
+        if (trainQuantiles.robustScaling (trainMean, trainPrec))
+            printf ("- Merged feature quantile sketches.\n");
+        else
+            printf ("- No feature quantile sketches yet, using the mean and "
+                    "standard deviation.\n");
+    }
+    testSet = trainSet;
+    trainSet.insert (trainSet.begin (), retained.begin (), retained.end ());
+    rawTrainSet = trainSet;
+    normalizeSet (trainSet, trainMean, trainPrec);
+    normalizeSet (testSet, trainMean, trainPrec);
+    printf ("********** Finished processing **********\n");
+}
+
 DataHandler::~DataHandler()
 {}
 
+void RunningMoments::add (const vecF_t &x)
+{
+    if (mean.size () == 0)
+    {
+        mean.assign (x.size (), 0.0);
+        m2.assign (x.size (), 0.0);
+    }
+    n += 1;
+    for (size_t j = 0; j < x.size (); j++)
+    {
+        double d = x[j] - mean[j];
+        mean[j] += d / n;
+        m2[j] += d * (x[j] - mean[j]);
+    }
+}
+
+void RunningMoments::merge (const RunningMoments &o)
+{
+    if (o.n == 0)
+        return;
+    if (n == 0)
+    {
+        *this = o;
+        return;
+    }
+    assert (mean.size () == o.mean.size ());
+    double N = n + o.n;
+    for (size_t j = 0; j < mean.size (); j++)
+    {
+        double d = o.mean[j] - mean[j];
+        mean[j] += d * o.n / N;
+        m2[j] += o.m2[j] + d * d * n * o.n / N;
+    }
+    n = N;
+}
+
+void FeatureQuantiles::add (const vecF_t &x, uint64_t weight)
+{
+    if (sketch.size () == 0)
+        sketch.resize (x.size ());
+    assert (sketch.size () == x.size ());
+    for (size_t j = 0; j < x.size (); j++)
+        sketch[j].add (x[j], weight);
+}
+
+void FeatureQuantiles::merge (const FeatureQuantiles &o)
+{
+    if (o.empty ())
+        return;
+    if (empty ())
+    {
+        *this = o;
+        return;
+    }
+    assert (sketch.size () == o.sketch.size ());
+    for (size_t j = 0; j < sketch.size (); j++)
+        sketch[j].merge (o.sketch[j]);
+}
+
+/* mu = median, prec = 1.349 / IQR, i.e. the IQR is scaled to the standard
+ * deviation of a normal distribution so normalized features stay in the
+ * units the rest of the code expects. Features with IQR 0 (mostly constant)
+ * keep the precision already in 'prec'. Without sketches (nothing added or
+ * read) mu and prec are left as they are and false is returned.
+*/
+bool FeatureQuantiles::robustScaling (vecD_t &mu, vecD_t &prec) const
+{
+    if (empty ())
+        return false;
+    mu.resize (sketch.size ());
+    prec.resize (sketch.size (), 1.0);
+    for (size_t j = 0; j < sketch.size (); j++)
+    {
+        mu[j] = sketch[j].quantile (0.5);
+        double iqr = sketch[j].quantile (0.75) - sketch[j].quantile (0.25);
+        if (iqr > 0)
+            prec[j] = 1.349 / iqr;
+    }
+    return true;
+}
+
+/// Boundaries of 'nbins' equal-frequency bins of feature 'j' (at most
+/// nbins - 1 increasing edges, repeated quantiles give one edge)
+void FeatureQuantiles::binEdges (size_t j, uint nbins, vecD_t &edges) const
+{
+    assert (j < sketch.size () && nbins > 0);
+    edges.clear ();
+    for (uint b = 1; b < nbins; b++)
+    {
+        double e = sketch[j].quantile (b / (double) nbins);
+        if (edges.size () == 0 || e > edges.back ())
+            edges.push_back (e);
+    }
+}
+
+void FeatureQuantiles::write (std::ostream &f) const
+{
+    f << "quantiles " << sketch.size () << "\n";
+    for (size_t j = 0; j < sketch.size (); j++)
+        sketch[j].write (f);
+}
+
+bool FeatureQuantiles::read (std::istream &f)
+{
+    Str_t word;
+    size_t n = 0;
+    f >> word >> n;
+    sketch.assign (n, QuantileSketch ());
+    for (size_t j = 0; j < n; j++)
+        if (!sketch[j].read (f))
+            return false;
+    return !f.fail ();
+}
+
+/// Same convention as DataHandler::mean and DataHandler::precision, so merged
+/// moments give the statistics a full rescan would have computed
+void RunningMoments::meanPrecision (vecD_t &mu, vecD_t &prec) const
+{
+    assert (n > 1);
+    mu.resize (mean.size ());
+    prec.resize (mean.size ());
+    for (size_t j = 0; j < mean.size (); j++)
+    {
+        mu[j] = mean[j] * n / (n - 1.0);
+        double ss = m2[j] + n * (mean[j] - mu[j]) * (mean[j] - mu[j]);
+        prec[j] = (ss > 0) ? 1. / std::sqrt (ss / (n - 1.0)) : 1.0;
+    }
+}
+
 /* **************************************************************************
  * Private member functions
  * **************************************************************************
@@ -52,37 +325,167 @@ DataHandler::~DataHandler()
 void DataHandler::getData (const Str_t &filename)
 {
     printf ("********** DataHandler processing **********\n");
-    getNumFeatures (filename);
-    fileReader (filename);
+    num_feat = readSamples (filename, samples);
+    countLabels ();
 }
 
-void DataHandler::getNumFeatures (const Str_t &filename)
+/* Reservoir sampling (Vitter's algorithm R) per class in one pass: the c-th
+ * row of a class replaces a random one of the k kept rows with probability
+ * k / c, so every row of the class is kept with the same probability k / n.
+ * Only the label of a row that is not kept is parsed. Unlabelled rows
+ * (label 0) are never sampled for training. Memory is O(k) rows per class.
+*/
+void DataHandler::reservoirSample (const Str_t &pattern, uint k)
 {
-    std::ifstream f(filename);
-    if(!f.is_open ())
+    struct Kept
     {
-        std::cout << "Error reading file: " << filename << "\n";
-        return;
-    }
+        sample_t s;
+        Str_t comment;
+        uint64_t row;
+    };
+    printf ("********** DataHandler processing (reservoir) **********\n");
+    std::map<label_t, vec<Kept> > kept;
+    std::mt19937_64 rng (12345);
+    uint64_t row = 0;
+    vec<Str_t> shards = expandShards (pattern);
+    assert (shards.size () > 0 || !(std::cout << "No input files: " << pattern << "\n"));
     Str_t line;
-    while (std::getline(f, line, '\n') && num_feat == 0)
+    for (size_t f = 0; f < shards.size (); f++)
     {
-        if (line[0] == '#') continue;
-        num_feat = std::stoul (
-                line.substr (
-                    line.substr (
-                        0, line.substr (
-                            0, line.find_first_of ('#')).find_last_of (':')).find_last_of (' ') + 1));
-    // TODO: find out number of samples to preallocate contiguous memory
+        LineReader in;
+        if (!in.open (shards[f]))
+        {
+            std::cout << "Error reading file: " << shards[f] << "\n";
+            continue;
+        }
+        while (in.getline (line))
+        {
+            if (line[0] == '#') continue;
+            uint64_t r = row++;
+            label_t lab = std::stod (line.substr (0, line.find (' ')), NULL);
+            uint c = ++classCount[lab];
+            if (lab > 0)
+                num_pos++;
+            else
+                num_neg++;
+            if (lab == 0)
+                continue;
+            vec<Kept> &res = kept[lab];
+            size_t slot = res.size ();
+            if (c > k)
+            {
+                slot = rng () % c;
+                if (slot >= k)
+                    continue;
+            }
+            else
+                res.push_back (Kept ());
+            Kept &e = res[slot];
+            e.s.clear ();
+            e.comment.clear ();
+            readLineSVMLightFormat (line, e.s, &e.comment);
+            e.row = r;
+        }
+        in.close ();
     }
-    f.close ();
-    assert (num_feat > 0);
+    vec<Kept *> all;
+    std::map<label_t, vec<Kept> >::iterator it;
+    for (it = kept.begin (); it != kept.end (); ++it)
+    {
+        if (it->second.size () < k)
+            printf ("- Class %g has only %lu rows, all used for training.\n",
+                    (double) it->first, it->second.size ());
+        for (size_t i = 0; i < it->second.size (); i++)
+            all.push_back (&it->second[i]);
+    }
+    std::sort (all.begin (), all.end (), [] (const Kept *a, const Kept *b)
+               { return a->row < b->row; });
+    trainSet.reserve (all.size ());
+    for (size_t i = 0; i < all.size (); i++)
+    {
+        trainSet.push_back (std::move (all[i]->s));
+        trainSet.back ().push_comment (all[i]->comment);
+        sampledRows.push_back (all[i]->row);
+    }
+    assert (trainSet.size () > 0 || !(std::cout << "No labelled rows in " << pattern << "\n"));
+    num_feat = numColumns (trainSet[0]);
+    num_train = k;
+    trainTestRatio = std::min (1.0, k / (double) minClassSamples ());
+    printf ("- Streamed %lu rows, %lu sampled for training.\n",
+            (unsigned long) row, trainSet.size ());
+    if (dedup)
+        deduplicateTrainSet ();
+    trainSetNormStats ();
+    normalizeSet (trainSet, trainMean, trainPrec);
+    printf ("********** Finished processing **********\n");
+}
+
+/* Stream every row of 'pattern' whose row number is not in 'skip' (sorted,
+ * see getSampledRowsConst) to 'fn' in batches of up to 'batch' rows. Rows
+ * are normalized with 'mu' / 'prec' (and clipped) unless in raw test mode;
+ * their comment offsets index the 'comments' passed along with the batch.
+ * Returns the number of rows streamed.
+*/
+size_t DataHandler::streamRows (const Str_t &pattern, const vec<uint64_t> &skip,
+                                const vecD_t &mu, const vecD_t &prec, size_t batch,
+                                const RowBatchFn &fn)
+{
+    vec<Str_t> shards = expandShards (pattern);
+    vecS_t rows;
+    Str_t line, comments;
+    rows.reserve (batch);
+    uint64_t row = 0;
+    size_t next = 0, streamed = 0;
+    auto flush = [&] ()
+    {
+        if (!rawTest)
+            TaskPool::instance ().parallelFor ("normalize stream", 0, rows.size (), 0, [&] (size_t i) {
+                for (size_t j = 0; j < mu.size (); j++)
+                {
+                    double z = (rows[i][j] - mu[j]) * prec[j];
+                    if (clip > 0)
+                        z = std::max (-clip, std::min (clip, z));
+                    rows[i][j] = z;
+                }
+            });
+        fn (rows, comments);
+        streamed += rows.size ();
+        rows.clear ();
+        comments.clear ();
+    };
+    for (size_t f = 0; f < shards.size (); f++)
+    {
+        LineReader in;
+        if (!in.open (shards[f]))
+        {
+            std::cout << "Error reading file: " << shards[f] << "\n";
+            continue;
+        }
+        while (in.getline (line))
+        {
+            if (line[0] == '#') continue;
+            uint64_t r = row++;
+            if (next < skip.size () && skip[next] == r)
+            {
+                next++;
+                continue;
+            }
+            rows.push_back (sample_t ());
+            readLineSVMLightFormat (line, rows.back (), &comments);
+            if (rows.size () == batch)
+                flush ();
+        }
+        in.close ();
+    }
+    if (rows.size () > 0)
+        flush ();
+    return streamed;
 }
 
 /// Determine the splits and assert that the split hasn't already been made
 void DataHandler::trainTestSplit (uint train_num_samples)
 {
-    uint min_samp = std::min(num_neg, num_pos);
+    uint min_samp = minClassSamples ();
     assert (samples.size () > 0 && trainSet.size () == 0 && testSet.size () == 0);  // TODO: remove this
     assert (train_num_samples <= min_samp && train_num_samples >= 0);
     trainTestRatio = train_num_samples / (double) min_samp;
@@ -95,11 +498,43 @@ void DataHandler::trainTestSplit (double train_to_test_ratio)
     assert (samples.size () > 0 && trainSet.size () == 0 && testSet.size () == 0);
     assert (train_to_test_ratio <= 1.0 && train_to_test_ratio >= 0.0);
     trainTestRatio = train_to_test_ratio;
-    num_train = (num_pos < num_neg) ? (uint)(num_pos * train_to_test_ratio + 0.5) :
-                                      (uint)(num_neg * train_to_test_ratio + 0.5);
+    num_train = (uint)(minClassSamples () * train_to_test_ratio + 0.5);
     populateNormalizeTrainTest ();
 }
 
+/// Number of samples in the smallest class
+uint DataHandler::minClassSamples () const
+{
+    if (!isMultiClass ())
+        return std::min (num_pos, num_neg);
+    uint min_samp = std::numeric_limits<uint>::max ();
+    std::map<label_t, uint>::const_iterator it;
+    for (it = classCount.begin (); it != classCount.end (); ++it)
+        if (it->first != 0)
+            min_samp = std::min (min_samp, it->second);
+    return min_samp;
+}
+
+/// Sorted list of class labels, i.e. all non-zero labels read
+vec<label_t> DataHandler::getClasses () const
+{
+    vec<label_t> classes;
+    std::map<label_t, uint>::const_iterator it;
+    for (it = classCount.begin (); it != classCount.end (); ++it)
+        if (it->first != 0)
+            classes.push_back (it->first);
+    return classes;
+}
+
+bool DataHandler::isMultiClass () const
+{
+    std::map<label_t, uint>::const_iterator it;
+    for (it = classCount.begin (); it != classCount.end (); ++it)
+        if (it->first != 0 && it->first != 1 && it->first != -1)
+            return true;
+    return false;
+}
+
 void DataHandler::populateNormalizeTrainTest ()
 {
     assert (trainTestRatio > 0 ||
@@ -114,38 +549,122 @@ void DataHandler::populateNormalizeTrainTest ()
     if (trainMean.size () == 0 && trainPrec.size () == 0)
         trainSetNormStats ();
     normalizeSet (trainSet, trainMean, trainPrec);
-    normalizeSet (testSet, trainMean, trainPrec);
+    if (!rawTest)
+        normalizeSet (testSet, trainMean, trainPrec);
+    else if (testSet.size () > 0)
+        printf ("- Testing set kept raw.\n");
+    normalizeSet (poolSet, trainMean, trainPrec);
     printf ("********** Finished processing **********\n");
 }
 
-/// Populate training set and testing set
+/* Populate training set and testing set
+ *
+ * With deduplication the identical rows of 'samples' form groups that are
+ * split as a whole: a group chosen for training becomes one sample weighted
+ * by the group and counts with that weight towards the class quota, a group
+ * chosen for testing (or the pool) keeps its rows. So no copy of a training
+ * row is tested, and the test rows keep their own comments.
+*/
 void DataHandler::populateTrainTest ()
 {
     size_t trainingSetSize = 2 * num_train;
-    size_t trainPos = 0, trainNeg = 0;
+    double trainPos = 0, trainNeg = 0, trainSize = 0;
     label_t lab = 0;
+    bool multi = isMultiClass ();
+    std::map<label_t, double> trainCount;
+    std::map<label_t, uint> poolQuota;
+    if (keepPool)
+    {
+        std::map<label_t, uint>::const_iterator it;
+        for (it = classCount.begin (); it != classCount.end (); ++it)
+        {
+            double share = std::min (trainTestRatio, 1.0) * it->second;
+            if (it->first != 0 && share > num_train)
+                poolQuota[it->first] = (uint) (share - num_train + 0.5);
+        }
+    }
+    // Deduplication: first row of every group, the weight of the group and
+    // the set its first row went to
+    enum { TRAIN, POOL, TEST };
+    vec<size_t> first;
+    vecD_t groupWeight;
+    vec<char> dest;
+    if (dedup && trainTestRatio > 0)
+    {
+        duplicateOf (samples, first);
+        groupWeight.assign (samples.size (), 0.0);
+        for (size_t i = 0; i < samples.size (); i++)
+            groupWeight[first[i]] += samples[i].getWeight ();
+        dest.assign (samples.size (), TEST);
+    }
+    const size_t total = samples.size ();
     vecS_t::iterator itS = samples.begin ();
-    sample_t sample;
-    sample.reserve (num_feat);
-    while (itS != samples.end ())
+    trainSet.reserve (trainingSetSize);
+    for (size_t i = 0; itS != samples.end (); ++itS, i++)
     {
         lab = itS->getLabel ();
-        if (trainSet.size () < trainingSetSize && lab > 0 && trainPos < num_train)
+        double w = 1, own = itS->getWeight ();
+        if (!first.empty () && first[i] != i)
         {
-            trainSet.push_back (*itS);
-            trainPos++;
+            // Later rows of a group follow the first one, a trained group
+            // is one sample already
+            if (dest[first[i]] == POOL)
+                poolSet.push_back (std::move (*itS));
+            else if (dest[first[i]] == TEST)
+                testSet.push_back (std::move (*itS));
+            continue;
         }
-        else if (trainSet.size () < trainingSetSize && lab <= 0 && trainNeg < num_train)
+        if (!first.empty ())
         {
-            trainSet.push_back (*itS);
-            trainNeg++;
+            w = groupWeight[i];
+            itS->setWeight (w);
         }
-        else
+        char to = TEST;
+        if (multi)
+        {
+            if (lab != 0 && trainCount[lab] < num_train)
+            {
+                trainCount[lab] += w;
+                to = TRAIN;
+            }
+            else if (lab != 0 && poolQuota[lab] > 0)
+            {
+                poolQuota[lab]--;
+                to = POOL;
+            }
+        }
+        else if (trainSize < trainingSetSize && lab > 0 && trainPos < num_train)
         {
-            testSet.push_back (*itS);
+            trainPos += w;
+            trainSize += w;
+            to = TRAIN;
         }
-        itS = samples.erase (itS);
+        else if (trainSize < trainingSetSize && lab <= 0 && trainNeg < num_train)
+        {
+            trainNeg += w;
+            trainSize += w;
+            to = TRAIN;
+        }
+        else if (lab != 0 && poolQuota[lab] > 0)
+        {
+            poolQuota[lab]--;
+            to = POOL;
+        }
+        if (to != TRAIN)
+            itS->setWeight (own);
+        if (!first.empty ())
+            dest[i] = to;
+        if (to == TRAIN)
+            trainSet.push_back (std::move (*itS));
+        else if (to == POOL)
+            poolSet.push_back (std::move (*itS));
+        else
+            testSet.push_back (std::move (*itS));
     }
+    samples.clear ();
+    if (!first.empty ())
+        printf ("- Deduplicated training set: %lu unique of %lu samples.\n",
+                trainSet.size (), (unsigned long) total);
     if (trainTestRatio == 0.0)
         printf ("- Number of samples in testing set: %lu\n", testSet.size ());
     else if (trainTestRatio == 1.0)
@@ -155,12 +674,14 @@ void DataHandler::populateTrainTest ()
         printf ("- Number of samples in training set: %lu\n", trainSet.size ());
         printf ("- Number of samples in testing set: %lu\n", testSet.size ());
     }
+    if (keepPool)
+        printf ("- Number of samples in mining pool: %lu\n", poolSet.size ());
     assert (samples.size () == 0);  // Free memory
     assert ((trainSet.size () > 0 && trainTestRatio > 0) ||
             (trainSet.size () == 0 && trainTestRatio == 0));
 }
 
-void DataHandler::_sum (const vecF_t &x, vecF_t &y)
+void DataHandler::_sum (const vecF_t &x, vecD_t &y)
 {
     assert (x.size () == y.size () ||
             !(std::cerr << "x size: " << x.size() << " and y size: " << y.size() << "\n"));
@@ -168,36 +689,59 @@ void DataHandler::_sum (const vecF_t &x, vecF_t &y)
         y[i] += x[i];
 }
 
-void DataHandler::_accumulate (const vecS_t &x, vecF_t &acc)
+/// Weighted sum of the features of 'x', returns the sum of the weights
+double DataHandler::_accumulate (const vecS_t &x, vecD_t &acc)
 {
+    double n = 0;
     vecS_t::const_iterator itS = x.begin ();
     while (itS != x.end ())
     {
-        _sum(itS->getFeatures (), acc);
+        double w = itS->getWeight ();
+        for (uint j = 0; j < acc.size (); j++)
+            acc[j] += w * (*itS)[j];
+        n += w;
         ++itS;
     }
+    return n;
 }
 
-void DataHandler::mean (const vecS_t &x, vecF_t &mu)
+/// Samples count with their weight, so the statistics of a deduplicated set
+/// are those of all its rows
+void DataHandler::mean (const vecS_t &x, vecD_t &mu)
 {
-    assert (mu.size () == num_feat);
+    assert (x.size () == 0 || mu.size () == x[0].size ());
     for (uint i = 0; i < mu.size (); i++)
         mu[i] = 0.0;
-    _accumulate(x, mu);
+    double n = _accumulate(x, mu);
     for (uint i = 0; i < mu.size (); i++)
-        mu[i] = mu[i] / (x.size() - 1.0);
+        mu[i] = mu[i] / (n - 1.0);
 }
 
-void DataHandler::precision (const vecS_t &x, vecF_t &prec, const vecF_t &mean)
+void DataHandler::precision (const vecS_t &x, vecD_t &prec, const vecD_t &mean)
 {
-    assert (prec.size () == num_feat);
+    assert (x.size () == 0 || prec.size () == x[0].size ());
+    double n = 0;
     for (uint i = 0; i < prec.size (); i++)
         prec[i] = 0.0;
     for (uint i = 0; i < x.size (); i++)
+    {
+        double w = x[i].getWeight ();
         for (uint j = 0; j < mean.size (); j++)
-            prec[j] += (x[i][j] - mean[j]) * (x[i][j] - mean[j]);
+            prec[j] += w * (x[i][j] - mean[j]) * (x[i][j] - mean[j]);
+        n += w;
+    }
+    // Constant features (e.g. hashed columns no index falls into) stay as they
+    // are instead of turning into NaNs
     for (uint i = 0; i < prec.size (); i++)
-        prec[i] = 1. / std::sqrt (prec[i] / (x.size() - 1.0));
+        prec[i] = (prec[i] > 0) ? 1. / std::sqrt (prec[i] / (n - 1.0)) : 1.0;
+}
+
+/// Deduplicate the (raw) training set, see deduplicate
+void DataHandler::deduplicateTrainSet ()
+{
+    size_t removed = deduplicate (trainSet);
+    printf ("- Deduplicated training set: %lu unique of %lu samples.\n",
+            trainSet.size (), trainSet.size () + removed);
 }
 
 void DataHandler::trainSetNormStats ()
@@ -205,17 +749,113 @@ void DataHandler::trainSetNormStats ()
     assert (trainMean.size () == 0 && trainPrec.size () == 0);
     trainMean.resize (num_feat);
     trainPrec.resize (num_feat);
-    mean (trainSet, trainMean);
-    precision (trainSet, trainPrec, trainMean);
-    printf ("- Computed training data statistics.\n");
+    if (hashSparse)
+    {
+        sparseNormStats (trainSet, trainMean, trainPrec);
+        printf ("- Computed sparse training data statistics (scaling only).\n");
+        return;
+    }
+    if (!robust)
+    {
+        mean (trainSet, trainMean);
+        precision (trainSet, trainPrec, trainMean);
+        printf ("- Computed training data statistics.\n");
+        return;
+    }
+    sketchSet (trainSet, trainQuantiles);
+    trainQuantiles.robustScaling (trainMean, trainPrec);
+    // Features with IQR 0 keep the standard precision, as with merged
+    // moments; it is only computed for them, on a copy of their columns
+    vec<size_t> flat;
+    for (size_t j = 0; j < num_feat; j++)
+        if (trainQuantiles.sketch[j].quantile (0.75) == trainQuantiles.sketch[j].quantile (0.25))
+            flat.push_back (j);
+    if (flat.size () > 0)
+    {
+        vecS_t cols (trainSet.size ());
+        for (size_t i = 0; i < trainSet.size (); i++)
+        {
+            cols[i].resize (flat.size ());
+            for (size_t k = 0; k < flat.size (); k++)
+                cols[i].feats[k] = trainSet[i][flat[k]];
+            cols[i].setWeight (trainSet[i].getWeight ());
+        }
+        vecD_t mu (flat.size ()), prec (flat.size ());
+        mean (cols, mu);
+        precision (cols, prec, mu);
+        for (size_t k = 0; k < flat.size (); k++)
+            trainPrec[flat[k]] = prec[k];
+    }
+    printf ("- Computed robust (median / IQR) statistics.\n");
+}
+
+/* Statistics of sparse rows, computed from their non-zeros: prec is the
+ * precision of DataHandler::precision (the implicit zeros count, with the
+ * weights), mu is left 0. Centering would turn every implicit zero of a
+ * column with mean m into -m prec, so sparse rows are only scaled.
+*/
+void DataHandler::sparseNormStats (const vecS_t &x, vecD_t &mu, vecD_t &prec)
+{
+    vecD_t s (mu.size (), 0.0), ss (mu.size (), 0.0);
+    double n = 0;
+    for (size_t i = 0; i < x.size (); i++)
+    {
+        double w = x[i].getWeight ();
+        for (size_t k = 0; k < x[i].idx.size (); k++)
+        {
+            s[x[i].idx[k]] += w * x[i][k];
+            ss[x[i].idx[k]] += w * x[i][k] * x[i][k];
+        }
+        n += w;
+    }
+    for (size_t j = 0; j < mu.size (); j++)
+    {
+        // sum_i w_i (x_ij - m)^2 with m = s / (n - 1) as in mean
+        double m = s[j] / (n - 1.0);
+        double d = ss[j] - 2 * m * s[j] + m * m * n;
+        prec[j] = (d > 0) ? 1. / std::sqrt (d / (n - 1.0)) : 1.0;
+        mu[j] = 0.0;
+    }
 }
 
-void DataHandler::normalizeSet (vecS_t &x, vecF_t &mu, vecF_t &prec)
+/// Sketch 'x' in parallel: one sketch per chunk of rows, merged in order so
+/// the result does not depend on the thread scheduling. Samples count with
+/// their weight.
+void DataHandler::sketchSet (const vecS_t &x, FeatureQuantiles &q)
+{
+    const size_t chunk = 4096;
+    vec<FeatureQuantiles> part ((x.size () + chunk - 1) / chunk);
+    TaskPool::instance ().parallelFor ("sketch", 0, part.size (), 1, [&] (size_t c) {
+        for (size_t i = c * chunk; i < std::min (x.size (), (c + 1) * chunk); i++)
+            part[c].add (x[i].getFeatures (), x[i].getWeight ());
+    });
+    for (size_t c = 0; c < part.size (); c++)
+        q.merge (part[c]);
+}
+
+void DataHandler::normalizeSet (vecS_t &x, vecD_t &mu, vecD_t &prec)
 {
     if (x.size () == 0) return;
+    if (hashSparse)
+    {
+        // Scaling only, see sparseNormStats
+        for (uint i = 0; i < x.size (); i++)
+            for (uint k = 0; k < x[i].idx.size (); k++)
+            {
+                x[i][k] *= prec[x[i].idx[k]];
+                if (clip > 0)
+                    x[i][k] = std::max ((feature_t) -clip, std::min ((feature_t) clip, x[i][k]));
+            }
+        printf ("- Data normalized.\n");
+        return;
+    }
     for (uint i = 0; i < x.size (); i++)
         for (uint j = 0; j < mu.size (); j++)
             x[i][j] = (x[i][j] - mu[j]) * prec[j];
+    if (clip > 0)
+        for (uint i = 0; i < x.size (); i++)
+            for (uint j = 0; j < mu.size (); j++)
+                x[i][j] = std::max ((feature_t) -clip, std::min ((feature_t) clip, x[i][j]));
     printf ("- Data normalized.\n");
 }
 
@@ -233,22 +873,26 @@ void DataHandler::randomizeSamples (vecS_t &x)
     printf ("- Data randomized.\n");
 }
 
-unsigned int DataHandler::readLineSVMLightFormat (const Str_t &txt, sample_t &feat)
+/// Parse one line into 'feat'. If 'comments' is given, the comment is appended
+/// to it and feat's comment offset is relative to it, otherwise it is interned
+/// in the CommentArena right away.
+unsigned int DataHandler::readLineSVMLightFormat (const Str_t &txt, sample_t &feat,
+                                                  Str_t *comments)
 {
-    // No support for sparse input. TODO: enable this
-//    long int ind = 0;
+    // Dense input: the values are taken in order and the indices ignored.
+    // With feature hashing the indices are hashed into 2^hashBits columns,
+    // sparse rows collect (column, value) pairs and merge collisions after.
     std::stringstream ss(txt);
     Str_t comment;
     Str_t word;
     std::size_t idx;
+    vec<std::pair<uint32_t, double> > pairs;
 
     std::getline(ss, word, ' ');
     label_t lab = std::stod (word, NULL);
-    if (lab > 0)
-        num_pos++;
-    else
-        num_neg++;
     feat.push_lab (lab);
+    if (hashBits > 0 && !hashSparse)
+        feat.feats.assign ((size_t) 1 << hashBits, 0);
     while(std::getline(ss, word, ' '))
     {
         if (word[0] == '#')
@@ -259,36 +903,255 @@ unsigned int DataHandler::readLineSVMLightFormat (const Str_t &txt, sample_t &fe
         idx = word.find (':');
         if (idx <= 0) continue;
 
-//        ind = std::stol (word.substr(0, idx));
-        feat.push_back (std::stod (word.substr(idx+1), NULL));
+        if (hashBits > 0)
+        {
+            size_t column;
+            double sign = hashFeature (word.data (), idx, column);
+            double v = sign * std::stod (word.substr(idx+1), NULL);
+            if (hashSparse)
+                pairs.push_back (std::make_pair ((uint32_t) column, v));
+            else
+                feat[column] += v;
+        }
+        else
+            feat.push_back (std::stod (word.substr(idx+1), NULL));
+    }
+    if (hashSparse)
+    {
+        std::sort (pairs.begin (), pairs.end ());
+        for (size_t k = 0; k < pairs.size (); )
+        {
+            size_t e = k;
+            double v = 0;
+            for (; e < pairs.size () && pairs[e].first == pairs[k].first; e++)
+                v += pairs[e].second;
+            if (v != 0)
+            {
+                feat.idx.push_back (pairs[k].first);
+                feat.push_back (v);
+            }
+            k = e;
+        }
     }
-    feat.push_comment (comment);
+    if (comments != NULL)
+    {
+        feat.setComment (comments->size (), comment.size ());
+        *comments += comment;
+    }
+    else
+        feat.push_comment (comment);
     return 0;
 }
 
-void DataHandler::fileReader (Str_t filename)
+/// Parse one file from byte 'offset' on and append its samples to 'out'.
+/// Does not touch any member, so several files can be read concurrently.
+/// Returns the offset after the last line read.
+std::streamoff DataHandler::readFile (const Str_t &filename, std::streamoff offset,
+                                      vecS_t &out)
 {
-    std::ifstream f(filename);
-    if(!f.is_open ())
+    LineReader f;
+    if(!f.open (filename, offset))
     {
         std::cout << "Error reading file: " << filename << "\n";
-        return;
+        return offset;
     }
-    Str_t line;
-
+    Str_t line, comments;
     sample_t feat;
-    feat.reserve (num_feat);
+    size_t first = out.size ();
 
-    while (std::getline(f, line, '\n'))
+    while (f.getline (line))
     {
         if (line[0] == '#') continue;
         feat.clear ();
-        readLineSVMLightFormat (line, feat);
-        samples.push_back (feat);
+        readLineSVMLightFormat (line, feat, &comments);
+        out.push_back (feat);
     }
-    printf("Finished reading %s file.\n", filename.c_str ());
-    std::cout << "Total number of examples read: " << samples.size () << "\n";
+    // One append (and lock) of the arena per file
+    uint64_t base = CommentArena::instance ().append (comments);
+    for (size_t i = first; i < out.size (); i++)
+        out[i].setComment (base + out[i].commentOff, out[i].commentLen);
+    std::streamoff end = f.tell ();
+    printf("Finished reading %s file: %lu examples.\n", filename.c_str (),
+           out.size () - first);
     f.close ();
+    return end;
+}
+
+/// A comma separated list of files and/or glob patterns, e.g.
+/// "features_05_*.txt.gz", as a sorted list of existing files
+vec<Str_t> DataHandler::expandShards (const Str_t &pattern)
+{
+    vec<Str_t> shards;
+    std::stringstream ss (pattern);
+    Str_t item;
+    while (std::getline (ss, item, ','))
+    {
+        if (item.find_first_of ("*?[") == Str_t::npos)
+        {
+            shards.push_back (item);
+            continue;
+        }
+        glob_t g;
+        if (glob (item.c_str (), 0, NULL, &g) == 0)
+            for (size_t i = 0; i < g.gl_pathc; i++)
+                shards.push_back (g.gl_pathv[i]);
+        else
+            std::cout << "No file matches: " << item << "\n";
+        globfree (&g);
+    }
+    return shards;
+}
+
+/* Read all shards of 'pattern' (see expandShards) into 'out'.
+ *
+ * Every shard is opened and parsed exactly once, shards are parsed
+ * concurrently into separate parts that are then moved (not copied) into
+ * 'out' in the order of the shard list. All samples must have the same number
+ * of features, which is returned.
+*/
+uint DataHandler::readSamples (const Str_t &pattern, vecS_t &out)
+{
+    vec<Str_t> shards = expandShards (pattern);
+    assert (shards.size () > 0 || !(std::cout << "No input files: " << pattern << "\n"));
+    vec<vecS_t> parts (shards.size ());
+    TaskPool::instance ().parallelFor ("read shard", 0, shards.size (), 1, [&] (size_t i) {
+        readFile (shards[i], 0, parts[i]);
+    });
+
+    uint nf = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < parts.size (); i++)
+    {
+        total += parts[i].size ();
+        for (size_t k = 0; k < parts[i].size (); k++)
+        {
+            if (nf == 0)
+                nf = numColumns (parts[i][k]);
+            assert (numColumns (parts[i][k]) == nf ||
+                    !(std::cout << "Inconsistent number of features in " << shards[i]
+                                << ": " << parts[i][k].size () << " instead of " << nf << "\n"));
+        }
+    }
+    out.reserve (out.size () + total);
+    for (size_t i = 0; i < parts.size (); i++)
+    {
+        out.insert (out.end (), std::make_move_iterator (parts[i].begin ()),
+                    std::make_move_iterator (parts[i].end ()));
+        vecS_t ().swap (parts[i]);
+    }
+    if (shards.size () > 1)
+        printf ("Merged %lu shards.\n", shards.size ());
+    std::cout << "Total number of examples read: " << out.size () << "\n";
+    assert (nf > 0);
+    return nf;
+}
+
+/// Hash of the label and the features of 's' (with the columns of a sparse
+/// row, not its comment or weight)
+uint64_t DataHandler::hashSample (const sample_t &s)
+{
+    // FNV-1a over the bytes of the label and the features
+    uint64_t h = 14695981039346656037ULL;
+    const unsigned char *p = (const unsigned char *) &s.lab;
+    for (size_t b = 0; b < sizeof (label_t); b++)
+        h = (h ^ p[b]) * 1099511628211ULL;
+    p = (const unsigned char *) s.feats.data ();
+    for (size_t b = 0; b < s.feats.size () * sizeof (feature_t); b++)
+        h = (h ^ p[b]) * 1099511628211ULL;
+    p = (const unsigned char *) s.idx.data ();
+    for (size_t b = 0; b < s.idx.size () * sizeof (uint32_t); b++)
+        h = (h ^ p[b]) * 1099511628211ULL;
+    return h;
+}
+
+/* first[i] = index of the first row of 'x' identical to row i (same
+ * features and label), i itself for the first occurrence. Hashing is
+ * parallel, equal hashes are compared feature by feature.
+*/
+void DataHandler::duplicateOf (const vecS_t &x, vec<size_t> &first)
+{
+    const size_t n = x.size ();
+    vec<uint64_t> h (n);
+    TaskPool::instance ().parallelFor ("hash rows", 0, n, 0, [&] (size_t i) {
+        h[i] = hashSample (x[i]);
+    });
+    vec<size_t> order (n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    std::sort (order.begin (), order.end (), [&] (size_t a, size_t b)
+               { return (h[a] != h[b]) ? h[a] < h[b] : a < b; });
+
+    first.resize (n);
+    for (size_t i = 0; i < n; i++)
+        first[i] = i;
+    for (size_t r = 0; r < n; )
+    {
+        size_t e = r + 1;
+        while (e < n && h[order[e]] == h[order[r]])
+            e++;
+        for (size_t i = r + 1; i < e; i++)
+            for (size_t j = r; j < i; j++)
+            {
+                const sample_t &a = x[order[i]], &b = x[order[j]];
+                if (first[order[j]] == order[j] && a.lab == b.lab && a.feats == b.feats &&
+                    a.idx == b.idx)
+                {
+                    first[order[i]] = order[j];
+                    break;
+                }
+            }
+        r = e;
+    }
+}
+
+/* Collapse exact duplicates (same features and label) of 'x' into one sample
+ * whose weight is the sum of their weights. The first occurrence is kept and
+ * the order of the kept samples is preserved. Returns the number of removed
+ * rows.
+*/
+size_t DataHandler::deduplicate (vecS_t &x)
+{
+    const size_t n = x.size ();
+    vec<size_t> first;
+    duplicateOf (x, first);
+    for (size_t i = 0; i < n; i++)
+        if (first[i] != i)
+            x[first[i]].setWeight (x[first[i]].getWeight () + x[i].getWeight ());
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+        if (first[i] == i)
+        {
+            if (k != i)
+                x[k] = std::move (x[i]);
+            k++;
+        }
+    x.resize (k);
+    return n - k;
+}
+
+void DataHandler::fileReader (Str_t filename, std::streamoff offset)
+{
+    size_t first = samples.size ();
+    endOffset = readFile (filename, offset, samples);
+    std::cout << "Total number of examples read: " << samples.size () << "\n";
+    if (num_feat == 0 && samples.size () > first)
+        num_feat = numColumns (samples[first]);
+    countLabels ();
+}
+
+void DataHandler::countLabels ()
+{
+    num_pos = num_neg = 0;
+    classCount.clear ();
+    for (size_t i = 0; i < samples.size (); i++)
+    {
+        label_t lab = samples[i].getLabel ();
+        if (lab > 0)
+            num_pos++;
+        else
+            num_neg++;
+        classCount[lab]++;
+    }
 }
 
 //Utility functions
@@ -11,6 +11,18 @@
 #include <iomanip>
 #include <cstdlib>
 #include <ctime>
+#include <map>
+#include <unordered_map>
+#include <limits>
+#include <iterator>
+#include <glob.h>
+#include <mutex>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include "linereader.h"
+#include "quantilesketch.h"
+#include "taskpool.h"
 
 
 // Define shorthands for commonly used types
@@ -18,58 +30,213 @@ template<typename T>
 using vec = std::vector<T>;
 
 typedef unsigned int uint;
+// Storage type of the features. Build with FEATURE_FLOAT ('make FLOAT=1') to
+// halve the memory and bandwidth of the datasets; statistics (vecD_t) and
+// dot products are always accumulated in double.
+#ifdef FEATURE_FLOAT
+typedef float feature_t;
+#else
 typedef double feature_t;
+#endif
 typedef vec<feature_t> vecF_t;
+typedef vec<double> vecD_t;
 typedef std::string Str_t;
 typedef double label_t;
 
+/* Process wide, append-only storage of the sample comments (clip names)
+ *
+ * A sample only keeps the offset and length of its comment in the arena, so
+ * shuffling, splitting and copying datasets never touches string data. The
+ * string is materialized by getComments when a report line or a file move
+ * needs it. Readers append the comments of a whole file (or batch) at once,
+ * see DataHandler::readFile.
+ *
+ * Appended strings are interned: appending a string that is already stored
+ * returns the offset of the stored copy, so reading the same rows again
+ * (materializeTestSet for every run, an incremental reload of the same
+ * file) does not grow the arena. Other than that the arena lives as long as
+ * the process and is never shrunk; comments of datasets that are gone stay.
+*/
+class CommentArena
+{
+public:
+    static CommentArena & instance ()
+    {
+        static CommentArena arena;
+        return arena;
+    }
+    /// Append 's' unless it is stored already, returns its offset in the arena
+    uint64_t append (const Str_t &s)
+    {
+        size_t h = std::hash<Str_t> () (s);
+        std::lock_guard<std::mutex> lock (m);
+        std::pair<Index::const_iterator, Index::const_iterator> r = stored.equal_range (h);
+        for (Index::const_iterator it = r.first; it != r.second; ++it)
+            if (data.compare (it->second, s.size (), s) == 0)
+                return it->second;
+        uint64_t off = data.size ();
+        data += s;
+        stored.insert (std::make_pair (h, off));
+        return off;
+    }
+    Str_t get (uint64_t off, uint32_t len)
+    {
+        std::lock_guard<std::mutex> lock (m);
+        return data.substr (off, len);
+    }
+    size_t size () const
+    {
+        std::lock_guard<std::mutex> lock (m);
+        return data.size ();
+    }
+
+private:
+    typedef std::unordered_multimap<size_t, uint64_t> Index;
+
+    CommentArena () {}
+    mutable std::mutex m;
+    Str_t data;
+    Index stored;           // hash of every appended string -> offset
+};
+
 typedef struct sample
 {
 public:
     sample () :
         feats (vecF_t ()),
         lab (0),
-        comment ("")
+        commentOff (0),
+        commentLen (0),
+        weight (1)
     {}
     ~sample () {}
     inline const vecF_t & getFeatures () { return feats; }
     inline const label_t & getLabel () { return lab; }
-    inline const Str_t & getComments () { return comment; }
     // Const members
     inline const vecF_t & getFeatures () const { return feats; }
     inline const label_t & getLabel () const { return lab; }
-    inline const Str_t & getComments () const { return comment; }
+    inline Str_t getComments () const
+    { return commentLen ? CommentArena::instance ().get (commentOff, commentLen) : Str_t (); }
     // Wrapper to the feature vector
     inline size_t numFeatures () { return feats.size (); }
     inline size_t size () { return feats.size (); }
     inline const size_t size () const { return feats.size (); }
-    inline void clear () { feats.clear (); }
+    inline void clear () { feats.clear (); idx.clear (); commentLen = 0; }
     inline void reserve (size_t t) { feats.reserve (t); }
     inline void resize (size_t t) { feats.resize (t); }
     // Add data
     inline void push_back (feature_t f) { feats.push_back (f); }
     inline void push_lab (label_t l) { lab = l; }
-    inline void push_comment (Str_t c) { comment = c; }
+    inline void push_comment (const Str_t &c)
+    { setComment (c.size () ? CommentArena::instance ().append (c) : 0, c.size ()); }
+    inline void setComment (uint64_t off, uint32_t len) { commentOff = off; commentLen = len; }
+    // Number of identical rows this sample stands for, see DataHandler::deduplicate
+    inline uint32_t getWeight () const { return weight; }
+    inline void setWeight (uint32_t w) { weight = w; }
     // Wrapper to access particular values of feats vector
     inline feature_t & operator[] (size_t t) { return feats[t]; }
     inline const feature_t & operator[] (size_t t) const { return feats[t]; }
 
     vecF_t feats;
+    // Sparse hashed rows (see DataHandler::setHashing): feats[k] is the value
+    // of column idx[k], increasing, the other columns are 0. Empty otherwise.
+    vec<uint32_t> idx;
     label_t lab;
-    Str_t comment;
+    uint64_t commentOff;
+    uint32_t commentLen;
+    uint32_t weight;
 } sample_t;
 
 typedef vec<sample_t> vecS_t;
 
+/* Running mean and sum of squared deviations (M2) of every feature
+ *
+ * Moments of two disjoint sets of rows can be merged exactly (Chan et al.),
+ * so the normalization statistics of a growing dataset are updated from the
+ * moments of the appended rows alone instead of rescanning the history.
+*/
+struct RunningMoments
+{
+    RunningMoments () : n(0) {}
+    void add (const vecF_t &x);
+    void merge (const RunningMoments &o);
+    void meanPrecision (vecD_t &mu, vecD_t &prec) const;
+
+    double n;
+    vecD_t mean;
+    vecD_t m2;
+};
+
+/* Quantile sketch of every feature, the robust counterpart of RunningMoments
+ *
+ * Mergeable like the moments: chunks of rows are sketched in parallel and
+ * merged, and the sketches of an incremental run are merged into the saved
+ * ones. robustScaling gives median / IQR statistics in the mu / prec form of
+ * DataHandler::normalizeSet, binEdges the quantile bin boundaries of a
+ * feature for tree models.
+*/
+struct FeatureQuantiles
+{
+    void add (const vecF_t &x, uint64_t weight = 1);
+    void merge (const FeatureQuantiles &o);
+    bool empty () const { return sketch.size () == 0; }
+    bool robustScaling (vecD_t &mu, vecD_t &prec) const;
+    void binEdges (size_t j, uint nbins, vecD_t &edges) const;
+    void write (std::ostream &f) const;
+    bool read (std::istream &f);
+
+    vec<QuantileSketch> sketch;
+};
+
 /* Class for handling the dataset requirements
  *
  * It has the following abilities:
- * - Read all samples and labels from a single file
+ * - Read all samples and labels from a single file, plain or compressed
+ *   ('.gz', '.zst'), see LineReader
+ * - Read a dataset sharded over several files: 'filename' may be a comma
+ *   separated list of files and glob patterns. Shards are parsed concurrently
+ *   and merged without copying the samples.
  * - Randomize the dataset
  * - Split into training (trainSet, trainLab) and testing (testSet, testLab) dataset
  * - Calculate the mean and precision for all features in the training dataset
  * - Standard normalize the training set
  * - Standard normalize the testing set
+ * - Robust scaling (setScaling): median / IQR from per-feature quantile
+ *   sketches instead of mean / standard deviation, and optionally clip the
+ *   normalized features to +-clip. Applies to every DataHandler, so test
+ *   data is transformed exactly as the training data.
+ * - Raw test mode (setRawTest): leave the testing set unnormalized for
+ *   models that fold the normalization into their weights.
+ * - Deduplication (setDeduplicate): collapse identical rows into weighted
+ *   samples before the train / test split, which counts them with their
+ *   weight (see populateTrainTest); the statistics count every sample with
+ *   its weight.
+ * - Feature hashing (setHashing): the indices of the index:value pairs are
+ *   hashed with a seed into 2^bits signed columns, so inputs with sparse
+ *   indices in the millions (or feature names) have a fixed width. Dense
+ *   rows store all 2^bits values, so bits is at most 16. Sparse rows store
+ *   the non-zero (column, value) pairs only (bits at most 22); they are
+ *   scaled by the standard deviation but not centered, which would fill
+ *   them (see trainSetNormStats), and train with the dcd solver on a
+ *   SparseFeatureMatrix. Models trained on hashed rows are only valid for
+ *   the same bits and seed, which incremental states record.
+ * - Reservoir mode (train_num_samples with 'reservoir'): one streaming pass
+ *   keeps a uniform random sample of train_num_samples rows of every class
+ *   as the training set; the other rows are never stored. The testing set
+ *   stays empty, streamRows delivers it in batches (memory O(batch)) and
+ *   getSampledRowsConst tells which rows to skip. (A caller may still keep
+ *   something per row, e.g. SVMTestSuite keeps a score and a label for the
+ *   ROC curve.)
+ * - Incremental mode: read only the rows appended after a byte offset of the
+ *   file, merge their RunningMoments into those of the earlier rows and use
+ *   the merged statistics for normalization. Rows retained from earlier runs
+ *   (e.g. support vectors) are put in front of the new rows in trainSet.
+ * - Optionally keep the labelled rows of the training share that balancing
+ *   leaves out (train_to_test_ratio of every class minus its training quota)
+ *   in a separate, normalized pool instead of the testing set
+ * - Multi-class labels: if any label other than -1/0/+1 is present, every
+ *   non-zero label is a class and the training set is balanced over all of
+ *   them. Label 0 always marks an unlabelled sample and goes to testing.
  *
  * Parameters:
  * - filename :             name of the file to be read
@@ -77,6 +244,8 @@ typedef vec<sample_t> vecS_t;
  *                          then it finds out the number of samples/class wrt
  *                          to the min samples/class.
  *          Ensures : training set has balanced class prob
+ * - keep_pool :            Keep the rows left out by balancing, see
+ *                          getPoolSetConst.
  * - mu :                   Vector of doubles with same size as number of features.
  * - prec :                 Vector of doubles with same size as number of features
  *                          If 'mu' and 'prec' are specified, train_to_test_ratio
@@ -93,15 +262,24 @@ typedef vec<sample_t> vecS_t;
  * - Specify train_to_test_ratio = 0.0 and also 'mu' and 'prec', if you want to
  *   read the data as testing data. In this case, randomization is skipped and the
  *   input mean and prec is used for test data set normalization.
+ * - Specify 'offset', 'moments' and 'retained' to read incrementally. All new
+ *   labelled rows are used for training, getNewSetConst returns them as well.
+ *   With robust scaling 'quantiles' are the sketches of the earlier rows.
 */
 class DataHandler
 {
 public:
-    DataHandler () {}
+    DataHandler () : endOffset(0) {}
     DataHandler (const Str_t &filename);
-    DataHandler (const Str_t &filename, double train_to_test_ratio);
-    DataHandler (const Str_t &filename, uint train_num_samples);
-    DataHandler (const Str_t &filename, const vecF_t &mu, const vecF_t &prec);
+    DataHandler (const Str_t &filename, double train_to_test_ratio,
+                 bool keep_pool = false);
+    DataHandler (const Str_t &filename, uint train_num_samples,
+                 bool keep_pool = false, bool reservoir = false);
+    DataHandler (const Str_t &filename, const vecD_t &mu, const vecD_t &prec);
+    DataHandler (vecS_t &parsed, const vecD_t &mu, const vecD_t &prec);
+    DataHandler (const Str_t &filename, std::streamoff offset,
+                 const RunningMoments &moments, const vecS_t &retained,
+                 const FeatureQuantiles &quantiles = FeatureQuantiles ());
     ~DataHandler ();
     const vecS_t & getTrainSetConst ()
     { assert (trainTestRatio > 0); return trainSet; }
@@ -109,11 +287,60 @@ public:
     const vecS_t & getTestSetConst ()
     { assert (trainTestRatio < 1); return testSet; }
 
-    const vecF_t & getTrainMeanConst ()
+    /// With keep_pool: labelled rows of the training share left out of the
+    /// balanced training set (normalized), candidates for hard example mining
+    const vecS_t & getPoolSetConst ()
+    { return poolSet; }
+
+    /// Incremental mode: the newly read labelled rows (normalized)
+    const vecS_t & getNewSetConst ()
+    { return testSet; }
+
+    const vecD_t & getTrainMeanConst ()
     { return trainMean; }
 
-    const vecF_t & getTrainPrecConst ()
+    const vecD_t & getTrainPrecConst ()
     { return trainPrec; }
+
+    const vecS_t & getRawTrainSetConst ()
+    { return rawTrainSet; }
+
+    const RunningMoments & getMomentsConst ()
+    { return trainMoments; }
+
+    /// Reservoir mode: sorted row numbers (comment lines not counted, over
+    /// all shards in order) of the training set
+    const vec<uint64_t> & getSampledRowsConst ()
+    { return sampledRows; }
+
+    /// Feature sketches of the training set, only built with robust scaling
+    const FeatureQuantiles & getQuantilesConst ()
+    { return trainQuantiles; }
+
+    std::streamoff getEndOffset () const
+    { return endOffset; }
+
+    vec<label_t> getClasses () const;
+    bool isMultiClass () const;
+    static vec<Str_t> expandShards (const Str_t &pattern);
+    static uint readSamples (const Str_t &pattern, vecS_t &out);
+    static size_t deduplicate (vecS_t &x);
+    static void duplicateOf (const vecS_t &x, vec<size_t> &first);
+    static uint64_t hashSample (const sample_t &s);
+    static void setScaling (bool robust, double clip);
+    static void setRawTest (bool raw);
+    static void setDeduplicate (bool d);
+    static void setHashing (uint bits, uint64_t seed, bool sparse = false);
+    static uint hashingBits () { return hashBits; }
+    static uint64_t hashingSeed () { return hashSeed; }
+    static bool sparseRows () { return hashSparse; }
+    static size_t numColumns (const sample_t &s)
+    { return hashSparse ? (size_t) 1 << hashBits : s.size (); }
+    static double hashFeature (const char *s, size_t n, size_t &column);
+    typedef std::function<void (const vecS_t &rows, const Str_t &comments)> RowBatchFn;
+    static size_t streamRows (const Str_t &pattern, const vec<uint64_t> &skip,
+                              const vecD_t &mu, const vecD_t &prec, size_t batch,
+                              const RowBatchFn &fn);
     // Utility functions
     void printSet (const vecS_t &x);
     void printSet (const vecF_t &x);
@@ -123,30 +350,53 @@ public:
 
 private:
     void getData (const Str_t &filename);
-    unsigned int readLineSVMLightFormat (const Str_t &txt, sample_t &feat);
-    void fileReader (Str_t filename);
-    void getNumFeatures (const Str_t &filename);
+    void reservoirSample (const Str_t &pattern, uint k);
+    static unsigned int readLineSVMLightFormat (const Str_t &txt, sample_t &feat,
+                                                Str_t *comments = NULL);
+    static std::streamoff readFile (const Str_t &filename, std::streamoff offset,
+                                    vecS_t &out);
+    void fileReader (Str_t filename, std::streamoff offset = 0);
+    void countLabels ();
     void randomizeSamples (vecS_t &x);
     void populateTrainTest ();
     void trainTestSplit (uint train_num_samples);
     void trainTestSplit (double train_to_test_ratio);
+    uint minClassSamples () const;
     void trainSetNormStats ();
+    void deduplicateTrainSet ();
+    static void sketchSet (const vecS_t &x, FeatureQuantiles &q);
+    static void sparseNormStats (const vecS_t &x, vecD_t &mu, vecD_t &prec);
     void populateNormalizeTrainTest ();
-    void normalizeSet (vecS_t &x, vecF_t &mu, vecF_t &prec);
+    void normalizeSet (vecS_t &x, vecD_t &mu, vecD_t &prec);
 
-    void _sum (const vecF_t &x, vecF_t &y);
-    void _accumulate (const vecS_t &x, vecF_t &acc);
-    void mean (const vecS_t &x, vecF_t &mu);
-    void precision (const vecS_t &x, vecF_t &prec, const vecF_t &mean);
+    void _sum (const vecF_t &x, vecD_t &y);
+    double _accumulate (const vecS_t &x, vecD_t &acc);
+    void mean (const vecS_t &x, vecD_t &mu);
+    void precision (const vecS_t &x, vecD_t &prec, const vecD_t &mean);
     // Variables
     vecS_t samples;
     vecS_t trainSet;
     vecS_t testSet;
+    vecS_t poolSet;
+    bool keepPool;
     uint num_pos;
     uint num_neg;
     uint num_train;
-    vecF_t trainMean;
-    vecF_t trainPrec;
+    std::map<label_t, uint> classCount;
+    vecD_t trainMean;
+    vecD_t trainPrec;
+    vecS_t rawTrainSet;
+    RunningMoments trainMoments;
+    FeatureQuantiles trainQuantiles;
+    vec<uint64_t> sampledRows;
+    std::streamoff endOffset;
+    static bool robust;
+    static double clip;
+    static bool rawTest;
+    static bool dedup;
+    static uint hashBits;
+    static uint64_t hashSeed;
+    static bool hashSparse;
 };
 
 // Utility function
@@ -0,0 +1,336 @@
+#include "dcdsolver.h"
+
+DCDSolver::DCDSolver () :
+    Cp(1.0),
+    Cn(1.0),
+    eps(0.1),
+    maxIter(1000),
+    iter(0),
+    shrinking(true),
+    warm(false),
+    rng(12345),
+    weights(NULL),
+    center(NULL),
+    rho(1.0),
+    bias(0)
+{}
+
+/// Use 'alpha_' as the starting point of the next call to train.
+/// Rows beyond alpha_.size () (e.g. newly appended samples) start from 0.
+void DCDSolver::warmStart (const vecD &alpha_)
+{
+    alpha = alpha_;
+    warm = true;
+}
+
+void DCDSolver::train (const FeatureMatrix &X, const LabelView &y)
+{
+    vec<size_t> rows (X.rows ());
+    for (size_t i = 0; i < rows.size (); i++)
+        rows[i] = i;
+    train (X, y, rows);
+}
+
+/// The operations of the solver on one row of a dense or a sparse matrix
+static inline double rowDot (const FeatureMatrix &X, size_t r, const vecD &w, double f)
+{
+    const feature_t *x = X.row (r);
+    for (size_t j = 0; j < w.size (); j++)
+        f += w[j] * x[j];
+    return f;
+}
+
+static inline double rowDot (const SparseFeatureMatrix &X, size_t r, const vecD &w, double f)
+{
+    for (size_t k = X.begin (r); k < X.end (r); k++)
+        f += w[X.idx[k]] * X.val[k];
+    return f;
+}
+
+static inline double rowNorm2 (const FeatureMatrix &X, size_t r, double f)
+{
+    const feature_t *x = X.row (r);
+    for (size_t j = 0; j < X.cols (); j++)
+        f += x[j] * x[j];
+    return f;
+}
+
+static inline double rowNorm2 (const SparseFeatureMatrix &X, size_t r, double f)
+{
+    for (size_t k = X.begin (r); k < X.end (r); k++)
+        f += X.val[k] * X.val[k];
+    return f;
+}
+
+static inline void rowAxpy (const FeatureMatrix &X, size_t r, double a, vecD &w)
+{
+    const feature_t *x = X.row (r);
+    for (size_t j = 0; j < w.size (); j++)
+        w[j] += a * x[j];
+}
+
+static inline void rowAxpy (const SparseFeatureMatrix &X, size_t r, double a, vecD &w)
+{
+    for (size_t k = X.begin (r); k < X.end (r); k++)
+        w[X.idx[k]] += a * X.val[k];
+}
+
+void DCDSolver::train (const FeatureMatrix &X, const LabelView &y,
+                       const vec<size_t> &rows)
+{
+    solve (X, y, rows);
+}
+
+void DCDSolver::train (const SparseFeatureMatrix &X, const LabelView &y,
+                       const vec<size_t> &rows)
+{
+    solve (X, y, rows);
+}
+
+template <class M>
+void DCDSolver::solve (const M &X, const LabelView &y, const vec<size_t> &rows)
+{
+    assert (X.rows () == y.size () && rows.size () > 0);
+    const size_t l = rows.size ();
+    const size_t d = X.cols ();
+    const double INF = std::numeric_limits<double>::infinity ();
+    vecD QD (l);
+    vec<size_t> index (l);
+    vec<signed char> yi (l);
+
+    if (!warm)
+        alpha.assign (l, 0.0);
+    alpha.resize (l, 0.0);
+    warm = false;
+    w.assign (d, 0.0);
+    bias = 0;
+    if (center != NULL)
+    {
+        assert (center->size () == d + 1);
+        std::copy (center->begin (), center->begin () + d, w.begin ());
+        bias = (*center)[d];
+    }
+
+    for (size_t s = 0; s < l; s++)
+    {
+        yi[s] = y[rows[s]];
+        double C = ((yi[s] > 0) ? Cp : Cn) * sampleWeight (rows[s]);
+        // Clip warm started variables to the (possibly new) box
+        alpha[s] = std::min (std::max (alpha[s], 0.0), C);
+        QD[s] = rowNorm2 (X, rows[s], 1.0) / rho;
+        double a = yi[s] * alpha[s] / rho;
+        if (a != 0)
+        {
+            rowAxpy (X, rows[s], a, w);
+            bias += a;
+        }
+        index[s] = s;
+    }
+
+    size_t active_size = l;
+    double PGmax_old = INF, PGmin_old = -INF;
+    for (iter = 0; iter < maxIter; iter++)
+    {
+        double PGmax_new = -INF, PGmin_new = INF;
+        std::shuffle (index.begin (), index.begin () + active_size, rng);
+
+        for (size_t s = 0; s < active_size; s++)
+        {
+            size_t i = index[s];
+            double C = ((yi[i] > 0) ? Cp : Cn) * sampleWeight (rows[i]);
+            double G = rowDot (X, rows[i], w, bias);
+            G = G * yi[i] - 1;
+
+            double PG = 0;
+            if (alpha[i] == 0)
+            {
+                if (shrinking && G > PGmax_old)
+                {
+                    std::swap (index[s--], index[--active_size]);
+                    continue;
+                }
+                else if (G < 0)
+                    PG = G;
+            }
+            else if (alpha[i] == C)
+            {
+                if (shrinking && G < PGmin_old)
+                {
+                    std::swap (index[s--], index[--active_size]);
+                    continue;
+                }
+                else if (G > 0)
+                    PG = G;
+            }
+            else
+                PG = G;
+
+            PGmax_new = std::max (PGmax_new, PG);
+            PGmin_new = std::min (PGmin_new, PG);
+
+            if (std::fabs (PG) > 1.0e-12)
+            {
+                double alpha_old = alpha[i];
+                alpha[i] = std::min (std::max (alpha[i] - G / QD[i], 0.0), C);
+                double delta = (alpha[i] - alpha_old) * yi[i] / rho;
+                rowAxpy (X, rows[i], delta, w);
+                bias += delta;
+            }
+        }
+
+        if (PGmax_new - PGmin_new <= eps)
+        {
+            if (active_size == l)
+                break;
+            // Converged on the shrunk problem, verify on the full one
+            active_size = l;
+            PGmax_old = INF;
+            PGmin_old = -INF;
+            continue;
+        }
+        PGmax_old = (PGmax_new <= 0) ? INF : PGmax_new;
+        PGmin_old = (PGmin_new >= 0) ? -INF : PGmin_new;
+    }
+    if (iter >= maxIter)
+        printf ("- DCDSolver: reached max number of iterations %u.\n", maxIter);
+}
+
+double DCDSolver::predict (const feature_t *x) const
+{
+    double f = bias;
+    for (size_t j = 0; j < w.size (); j++)
+        f += w[j] * x[j];
+    return f;
+}
+
+/// Split 'rows' into fold 'k' of 'nfold' (testRows) and the rest (trainRows).
+/// Folds are contiguous per class, like in dlib::cross_validate_trainer.
+void classFolds (const LabelView &y, const vec<size_t> &rows, uint nfold,
+                 uint k, vec<size_t> &trainRows, vec<size_t> &testRows)
+{
+    vec<size_t> pos, neg;
+    for (size_t i = 0; i < rows.size (); i++)
+    {
+        if (y[rows[i]] > 0)
+            pos.push_back (rows[i]);
+        else
+            neg.push_back (rows[i]);
+    }
+    assert (pos.size () >= nfold && neg.size () >= nfold);
+    trainRows.clear ();
+    testRows.clear ();
+    size_t pb = k * pos.size () / nfold, pe = (k + 1) * pos.size () / nfold;
+    size_t nb = k * neg.size () / nfold, ne = (k + 1) * neg.size () / nfold;
+    for (size_t i = 0; i < pos.size (); i++)
+        ((i >= pb && i < pe) ? testRows : trainRows).push_back (pos[i]);
+    for (size_t i = 0; i < neg.size (); i++)
+        ((i >= nb && i < ne) ? testRows : trainRows).push_back (neg[i]);
+}
+
+/* nfold cross validation of solver 's' (with its Cs) on the given rows of X.
+ *
+ * The folds (see classFolds) are passed to the solver as lists of rows, the
+ * data is not copied. Every fold trains its own copy of 's' as a task of the
+ * pool, 's' itself is not changed. The dual variables of every fold are
+ * stored in 'foldAlpha' and warm start the same fold in the next call if the
+ * fold sizes match. If 'oof' is given, it receives the out-of-fold score of
+ * every row (indexed like X), i.e. the score from the model that did not see
+ * it. Returns the fraction of correctly classified +1 / -1 samples in accPos /
+ * accNeg (counted with the sample weights of the solver), and the number of
+ * training samples processed over all folds. If 'foldAcc' is given, it
+ * receives the same two fractions for every fold, fold k at 2k and 2k + 1.
+*/
+static inline double predictRow (const DCDSolver &f, const FeatureMatrix &X, size_t r)
+{
+    return f.predict (X.row (r));
+}
+
+static inline double predictRow (const DCDSolver &f, const SparseFeatureMatrix &X, size_t r)
+{
+    return f.predict (X, r);
+}
+
+template <class M>
+static size_t crossValidateRows (const DCDSolver &s, const M &X,
+                                 const LabelView &y, const vec<size_t> &rows,
+                                 uint nfold, vec<vecD> &foldAlpha,
+                                 double &accPos, double &accNeg, vecD *oof,
+                                 vecD *foldAcc)
+{
+    foldAlpha.resize (nfold);
+    if (oof != NULL)
+        oof->resize (X.rows (), 0.0);
+    // Per fold sums, added in fold order so the result does not depend on
+    // the scheduling
+    vecD cpos (nfold, 0.0), cneg (nfold, 0.0), tpos (nfold, 0.0), tneg (nfold, 0.0);
+    vec<size_t> trained (nfold, 0);
+    TaskPool::instance ().parallelFor ("cv fold", 0, nfold, 1, [&] (size_t k) {
+        vec<size_t> trainRows, testRows;
+        classFolds (y, rows, nfold, k, trainRows, testRows);
+        DCDSolver f = s;
+        if (foldAlpha[k].size () == trainRows.size ())
+            f.warmStart (foldAlpha[k]);
+        f.train (X, y, trainRows);
+        foldAlpha[k] = f.getAlpha ();
+        trained[k] = trainRows.size ();
+        for (size_t i = 0; i < testRows.size (); i++)
+        {
+            double p = predictRow (f, X, testRows[i]);
+            if (oof != NULL)
+                (*oof)[testRows[i]] = p;
+            double w = f.sampleWeight (testRows[i]);
+            if (y[testRows[i]] > 0)
+            {
+                tpos[k] += w;
+                cpos[k] += w * (p >= 0);
+            }
+            else
+            {
+                tneg[k] += w;
+                cneg[k] += w * (p < 0);
+            }
+        }
+    });
+    double cp = 0, cn = 0, tp = 0, tn = 0;
+    size_t evaluations = 0;
+    for (uint k = 0; k < nfold; k++)
+    {
+        cp += cpos[k];
+        cn += cneg[k];
+        tp += tpos[k];
+        tn += tneg[k];
+        evaluations += trained[k];
+    }
+    accPos = cp / tp;
+    accNeg = cn / tn;
+    if (foldAcc != NULL)
+    {
+        foldAcc->resize (2 * nfold);
+        for (uint k = 0; k < nfold; k++)
+        {
+            (*foldAcc)[2 * k] = cpos[k] / tpos[k];
+            (*foldAcc)[2 * k + 1] = cneg[k] / tneg[k];
+        }
+    }
+    return evaluations;
+}
+
+size_t dcdCrossValidate (const DCDSolver &s, const FeatureMatrix &X,
+                         const LabelView &y, const vec<size_t> &rows,
+                         uint nfold, vec<vecD> &foldAlpha,
+                         double &accPos, double &accNeg, vecD *oof,
+                         vecD *foldAcc)
+{
+    return crossValidateRows (s, X, y, rows, nfold, foldAlpha, accPos, accNeg,
+                              oof, foldAcc);
+}
+
+size_t dcdCrossValidate (const DCDSolver &s, const SparseFeatureMatrix &X,
+                         const LabelView &y, const vec<size_t> &rows,
+                         uint nfold, vec<vecD> &foldAlpha,
+                         double &accPos, double &accNeg, vecD *oof,
+                         vecD *foldAcc)
+{
+    return crossValidateRows (s, X, y, rows, nfold, foldAlpha, accPos, accNeg,
+                              oof, foldAcc);
+}
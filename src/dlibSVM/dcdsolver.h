@@ -0,0 +1,131 @@
+#ifndef DCDSOLVER_H
+#define DCDSOLVER_H
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include "dataconverter.h"
+
+/* Read-only view of a label vector as +1/-1 training targets
+ *
+ * A binary view maps y > 0 to +1 and everything else to -1. A one-vs-rest
+ * view maps y == positive to +1 and every other class to -1. Neither the
+ * labels nor the features are copied, so K one-vs-rest problems can share a
+ * single dataset.
+*/
+struct LabelView
+{
+    LabelView (const vec<label_t> &y_) :
+        y(&y_), oneVsRest(false), positive(0) {}
+    LabelView (const vec<label_t> &y_, label_t positive_) :
+        y(&y_), oneVsRest(true), positive(positive_) {}
+    inline int operator[] (size_t i) const
+    { return (oneVsRest ? (*y)[i] == positive : (*y)[i] > 0) ? +1 : -1; }
+    inline size_t size () const { return y->size (); }
+
+    const vec<label_t> *y;
+    bool oneVsRest;
+    label_t positive;
+};
+
+/* Dual coordinate descent solver for the L1-loss (hinge) linear SVM
+ *
+ * Implements the liblinear style solver of Hsieh et al. (ICML 2008):
+ *
+ *      min_alpha  0.5 * alpha' Q alpha - e' alpha
+ *      s.t.       0 <= alpha_i <= C_{y_i}
+ *
+ * where Q_ij = y_i y_j x_i' x_j. The primal weight vector w = sum y_i alpha_i x_i
+ * is maintained incrementally so that every coordinate update costs O(d).
+ * A constant feature of value 1 is appended to every sample to learn the bias,
+ * so the decision function is f(x) = w' x + bias.
+ *
+ * It has the following abilities:
+ * - Trains directly on a contiguous row-major FeatureMatrix, or on the
+ *   non-zeros of a SparseFeatureMatrix (sparse hashed rows)
+ * - Optional subset of rows to train on (no copy of the data is made)
+ * - Separate C for the positive and the negative class
+ * - Active set shrinking of variables stuck at their bounds
+ * - Random permutation of the active set in every epoch
+ * - Warm start from the dual variables of a previous run
+ * - Integer sample weights (deduplicated rows): a sample of weight k has the
+ *   box [0, k C], which is exactly the dual of k identical samples
+ * - Proximal regularizer (setProximal): (rho / 2) ||w - c||^2 replaces
+ *   0.5 ||w||^2 (c includes the bias as its last entry), then
+ *   w = c + sum y_i alpha_i x_i / rho. This is the local subproblem of
+ *   consensus ADMM, see DistributedSVM.
+ *
+ * Usage:
+ * - Set Cs with setPosC/setNegC, optionally call warmStart with the alphas
+ *   of an earlier call to train and then call train.
+ * - getWeights/getBias return the learned hyperplane.
+*/
+class DCDSolver
+{
+public:
+    DCDSolver ();
+    void setC (double C_) { Cp = C_; Cn = C_; }
+    void setPosC (double C_) { Cp = C_; }
+    void setNegC (double C_) { Cn = C_; }
+    void setEpsilon (double e) { eps = e; }
+    void setMaxIterations (uint it) { maxIter = it; }
+    void setShrinking (bool s) { shrinking = s; }
+    void setSeed (uint s) { rng.seed (s); }
+    void setSampleWeights (const vecD *sw) { weights = sw; }
+    void setProximal (const vecD *center_, double rho_)
+    { center = center_; rho = rho_; }
+    inline double sampleWeight (size_t row) const
+    { return (weights != NULL) ? (*weights)[row] : 1.0; }
+    void warmStart (const vecD &alpha_);
+    void train (const FeatureMatrix &X, const LabelView &y);
+    void train (const FeatureMatrix &X, const LabelView &y,
+                const vec<size_t> &rows);
+    void train (const SparseFeatureMatrix &X, const LabelView &y,
+                const vec<size_t> &rows);
+    double predict (const feature_t *x) const;
+    double predict (const SparseFeatureMatrix &X, size_t i) const
+    { return bias + X.dot (i, w.data ()); }
+
+    const vecD & getWeights () const { return w; }
+    double getBias () const { return bias; }
+    const vecD & getAlpha () const { return alpha; }
+    uint getIterations () const { return iter; }
+    double getPosC () const { return Cp; }
+    double getNegC () const { return Cn; }
+    double getEpsilon () const { return eps; }
+
+private:
+    template <class M>
+    void solve (const M &X, const LabelView &y, const vec<size_t> &rows);
+
+    double Cp;
+    double Cn;
+    double eps;
+    uint maxIter;
+    uint iter;
+    bool shrinking;
+    bool warm;
+    std::mt19937 rng;
+    const vecD *weights;
+    const vecD *center;
+    double rho;
+    vecD alpha;
+    vecD w;
+    double bias;
+};
+
+void classFolds (const LabelView &y, const vec<size_t> &rows, uint nfold,
+                 uint k, vec<size_t> &trainRows, vec<size_t> &testRows);
+size_t dcdCrossValidate (const DCDSolver &s, const FeatureMatrix &X,
+                         const LabelView &y, const vec<size_t> &rows,
+                         uint nfold, vec<vecD> &foldAlpha,
+                         double &accPos, double &accNeg, vecD *oof = NULL,
+                         vecD *foldAcc = NULL);
+size_t dcdCrossValidate (const DCDSolver &s, const SparseFeatureMatrix &X,
+                         const LabelView &y, const vec<size_t> &rows,
+                         uint nfold, vec<vecD> &foldAlpha,
+                         double &accPos, double &accNeg, vecD *oof = NULL,
+                         vecD *foldAcc = NULL);
+
+#endif // DCDSOLVER_H
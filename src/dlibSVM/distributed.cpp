@@ -0,0 +1,449 @@
+#include "distributed.h"
+#include <set>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* Messages between the coordinator and the workers: a type and the payload
+ * size followed by the payload, text for the setup and the statistics,
+ * native doubles for everything sent per iteration.
+*/
+enum {
+    MSG_LOAD = 1,       // coordinator: "threads robust clip bits seed\nshards"
+    MSG_STATS,          // worker: rows, features, moments, labels (, quantiles)
+    MSG_NORM,           // coordinator: mu, prec
+    MSG_TRAIN,          // coordinator: Cp, Cn, warm start, features
+    MSG_SOLVE,          // coordinator: center, rho
+    MSG_WEIGHTS,        // worker: w, bias
+    MSG_QUIT
+};
+
+struct MsgHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t bytes;
+};
+
+static bool sendAll (int fd, const char *p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t k = send (fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+static bool recvAll (int fd, char *p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t k = recv (fd, p, n, 0);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+static bool sendMsg (int fd, uint32_t type, const Str_t &payload)
+{
+    MsgHeader h;
+    h.type = type;
+    h.reserved = 0;
+    h.bytes = payload.size ();
+    return sendAll (fd, (const char *) &h, sizeof (h)) &&
+           sendAll (fd, payload.data (), payload.size ());
+}
+
+static bool recvMsg (int fd, uint32_t &type, Str_t &payload)
+{
+    MsgHeader h;
+    if (!recvAll (fd, (char *) &h, sizeof (h)))
+        return false;
+    type = h.type;
+    payload.resize (h.bytes);
+    return h.bytes == 0 || recvAll (fd, &payload[0], h.bytes);
+}
+
+static Str_t toBytes (const vecD_t &v)
+{
+    return Str_t ((const char *) v.data (), v.size () * sizeof (double));
+}
+
+static vecD_t fromBytes (const Str_t &s)
+{
+    vecD_t v (s.size () / sizeof (double));
+    if (v.size () > 0)
+        memcpy (v.data (), s.data (), v.size () * sizeof (double));
+    return v;
+}
+
+static double norm2 (const vecD_t &v)
+{
+    double s = 0;
+    for (size_t j = 0; j < v.size (); j++)
+        s += v[j] * v[j];
+    return s;
+}
+
+DistributedSVM::DistributedSVM () :
+    total(0),
+    numFeat(0),
+    robust(false),
+    method(MIX_ADMM),
+    rho(10.0),
+    maxIter(200),
+    iter(0),
+    tol(1e-3)
+{}
+
+DistributedSVM::~DistributedSVM ()
+{
+    stop ();
+}
+
+/// Start min(workers, number of shards) workers with 'threads' task pool
+/// threads each and collect the statistics of their shards
+void DistributedSVM::start (const Str_t &pattern, uint workers, uint threads,
+                            bool robust_, double clip)
+{
+    assert (!running () && workers > 0);
+    robust = robust_;
+    vec<Str_t> shards = DataHandler::expandShards (pattern);
+    assert (shards.size () > 0 || !(std::cout << "No input files: " << pattern << "\n"));
+    size_t n = std::min ((size_t) workers, shards.size ());
+    if (n < workers)
+        printf ("- Only %lu shards, starting %lu workers.\n", shards.size (), n);
+    vec<Str_t> assigned (n);
+    for (size_t i = 0; i < shards.size (); i++)
+        assigned[i % n] += (assigned[i % n].size () ? "," : "") + shards[i];
+
+    for (size_t k = 0; k < n; k++)
+    {
+        int sv[2];
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+        {
+            perror ("socketpair");
+            exit (-1);
+        }
+        char fdArg[16];
+        snprintf (fdArg, sizeof (fdArg), "%d", sv[1]);
+        pid_t pid = fork ();
+        if (pid == 0)
+        {
+            // Only the worker's end of its own socket survives the exec
+            fcntl (sv[1], F_SETFD, 0);
+            execl ("/proc/self/exe", "svm", "--worker", fdArg, (char *) NULL);
+            _exit (127);
+        }
+        close (sv[1]);
+        if (pid < 0)
+        {
+            perror ("fork");
+            exit (-1);
+        }
+        fds.push_back (sv[0]);
+        pids.push_back (pid);
+        std::stringstream ss;
+        ss << threads << " " << robust << " " << std::setprecision (17) << clip
+           << " " << DataHandler::hashingBits () << " " << DataHandler::hashingSeed ()
+           << "\n" << assigned[k];
+        sendMsg (sv[0], MSG_LOAD, ss.str ());
+    }
+    printf ("- Started %lu training workers.\n", n);
+
+    std::set<label_t> labels;
+    uint32_t type;
+    Str_t payload;
+    shardRows.assign (n, 0.0);
+    total = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        if (!recvMsg (fds[k], type, payload) || type != MSG_STATS)
+        {
+            std::cout << "Distributed worker " << k << " failed to load its shards.\n";
+            exit (-1);
+        }
+        std::stringstream ss (payload);
+        size_t rows, nl;
+        uint nf;
+        RunningMoments m;
+        ss >> rows >> nf >> m.n >> nl;
+        m.mean.resize (nf);
+        m.m2.resize (nf);
+        for (uint j = 0; j < nf; j++)
+            ss >> m.mean[j] >> m.m2[j];
+        for (size_t c = 0; c < nl; c++)
+        {
+            label_t l;
+            ss >> l;
+            labels.insert (l);
+        }
+        assert (numFeat == 0 || nf == numFeat ||
+                !(std::cout << "Inconsistent number of features in the shards of worker "
+                            << k << ": " << nf << " instead of " << numFeat << "\n"));
+        numFeat = nf;
+        shardRows[k] = rows;
+        total += rows;
+        if (rows == 0)
+            continue;
+        moments.merge (m);
+        if (robust)
+        {
+            FeatureQuantiles q;
+            bool ok = q.read (ss);
+            assert (ok || !(std::cout << "Bad quantile sketches from worker " << k << "\n"));
+            quantiles.merge (q);
+        }
+    }
+    classes.assign (labels.begin (), labels.end ());
+    printf ("- Merged training data statistics of %lu samples from %lu workers.\n",
+            total, n);
+}
+
+/// Merged normalization statistics of all shards, also sent to the workers
+void DistributedSVM::normalization (vecD_t &mu, vecD_t &prec)
+{
+    moments.meanPrecision (mu, prec);
+    if (robust && !quantiles.robustScaling (mu, prec))
+        printf ("- No feature quantile sketches, using the mean and standard deviation.\n");
+    vecD_t v (mu);
+    v.insert (v.end (), prec.begin (), prec.end ());
+    broadcast (MSG_NORM, v);
+}
+
+/// Train on the columns 'features' of all shards, see the class comment
+void DistributedSVM::train (const vec<size_t> &features, double Cp, double Cn,
+                            vecD_t &w, double &bias)
+{
+    const size_t n = fds.size (), d = features.size () + 1;
+    vecD_t setup;
+    setup.push_back (Cp);
+    setup.push_back (Cn);
+    setup.push_back (method == MIX_ADMM);
+    for (size_t j = 0; j < features.size (); j++)
+        setup.push_back (features[j]);
+    broadcast (MSG_TRAIN, setup);
+
+    double rp = 0, rd = 0;
+    vecD_t z (d, 0.0), zOld, c (d + 1);
+    vec<vecD_t> u (n, vecD_t (d, 0.0)), wk;
+    for (iter = 0; iter < maxIter; )
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            for (size_t j = 0; j < d; j++)
+                c[j] = (method == MIX_ADMM) ? z[j] - u[k][j] : z[j];
+            c[d] = rho;
+            sendMsg (fds[k], MSG_SOLVE, toBytes (c));
+        }
+        gather (wk);
+        iter++;
+        zOld = z;
+        if (method == MIX_AVERAGE)
+        {
+            for (size_t j = 0; j < d; j++)
+            {
+                z[j] = 0;
+                for (size_t k = 0; k < n; k++)
+                    z[j] += shardRows[k] * wk[k][j] / total;
+                zOld[j] -= z[j];
+            }
+            rd = std::sqrt (norm2 (zOld));
+            if (rd <= tol * (std::sqrt (d) + std::sqrt (norm2 (z))))
+                break;
+            continue;
+        }
+
+        double sw = 0, su = 0;
+        rp = 0;
+        for (size_t j = 0; j < d; j++)
+        {
+            double s = 0;
+            for (size_t k = 0; k < n; k++)
+                s += wk[k][j] + u[k][j];
+            z[j] = rho * s / (1.0 + n * rho);
+        }
+        for (size_t k = 0; k < n; k++)
+            for (size_t j = 0; j < d; j++)
+            {
+                u[k][j] += wk[k][j] - z[j];
+                rp += (wk[k][j] - z[j]) * (wk[k][j] - z[j]);
+                sw += wk[k][j] * wk[k][j];
+                su += u[k][j] * u[k][j];
+            }
+        for (size_t j = 0; j < d; j++)
+            zOld[j] -= z[j];
+        rp = std::sqrt (rp);
+        rd = rho * std::sqrt (n * norm2 (zOld));
+        double epsAbs = std::sqrt (n * d) * tol;
+        if (rp <= epsAbs + tol * std::max (std::sqrt (sw), std::sqrt (n * norm2 (z))) &&
+            rd <= epsAbs + tol * rho * std::sqrt (su))
+            break;
+    }
+    if (method == MIX_ADMM)
+        printf ("- ADMM over %lu workers: %u iterations, residuals %g / %g.\n",
+                n, iter, rp, rd);
+    else
+        printf ("- Parameter mixing over %lu workers: %u rounds, last change %g.\n",
+                n, iter, rd);
+    if (iter >= maxIter)
+        printf ("- DistributedSVM: reached max number of iterations %u.\n", maxIter);
+    w.assign (z.begin (), z.end () - 1);
+    bias = z[d - 1];
+}
+
+/// Let the workers exit and reap them
+void DistributedSVM::stop ()
+{
+    for (size_t k = 0; k < fds.size (); k++)
+    {
+        sendMsg (fds[k], MSG_QUIT, Str_t ());
+        close (fds[k]);
+    }
+    for (size_t k = 0; k < pids.size (); k++)
+        waitpid (pids[k], NULL, 0);
+    fds.clear ();
+    pids.clear ();
+}
+
+void DistributedSVM::broadcast (uint32_t type, const vecD_t &v)
+{
+    Str_t payload = toBytes (v);
+    for (size_t k = 0; k < fds.size (); k++)
+        sendMsg (fds[k], type, payload);
+}
+
+/// The weights of every worker, in worker order
+void DistributedSVM::gather (vec<vecD_t> &v)
+{
+    uint32_t type;
+    Str_t payload;
+    v.resize (fds.size ());
+    for (size_t k = 0; k < fds.size (); k++)
+    {
+        if (!recvMsg (fds[k], type, payload) || type != MSG_WEIGHTS)
+        {
+            std::cout << "Distributed worker " << k << " failed.\n";
+            exit (-1);
+        }
+        v[k] = fromBytes (payload);
+    }
+}
+
+/* Entry point of a worker process ('svm --worker fd'): serves the
+ * coordinator on socket 'fd' until it sends MSG_QUIT or closes the socket.
+*/
+int DistributedSVM::workerMain (int fd)
+{
+    // exec keeps the CPU mask of the spawning thread, run on every CPU
+    TaskPool::unpin ();
+    vecS_t rows;
+    vec<label_t> labels;
+    FeatureMatrix X;
+    DCDSolver dcd;
+    vecD_t alpha, center;
+    bool warm = false;
+    uint32_t type;
+    Str_t payload;
+    while (recvMsg (fd, type, payload))
+    {
+        if (type == MSG_QUIT)
+            break;
+        if (type == MSG_LOAD)
+        {
+            std::stringstream ss (payload);
+            uint threads;
+            bool robust;
+            double clip;
+            uint bits;
+            uint64_t seed;
+            Str_t pattern;
+            ss >> threads >> robust >> clip >> bits >> seed;
+            ss.ignore (1);
+            std::getline (ss, pattern);
+            TaskPool::instance ().configure (threads, false, false);
+            DataHandler::setScaling (robust, clip);
+            DataHandler::setHashing (bits, seed);
+            vecS_t all;
+            uint nf = DataHandler::readSamples (pattern, all);
+            RunningMoments m;
+            FeatureQuantiles q;
+            std::set<label_t> seen;
+            for (size_t i = 0; i < all.size (); i++)
+                if (all[i].getLabel () != 0)
+                {
+                    m.add (all[i].getFeatures ());
+                    if (robust)
+                        q.add (all[i].getFeatures ());
+                    seen.insert (all[i].getLabel ());
+                    rows.push_back (std::move (all[i]));
+                }
+            vecS_t ().swap (all);
+            std::stringstream out;
+            out << std::setprecision (17) << rows.size () << " " << nf << " "
+                << m.n << " " << seen.size () << "\n";
+            for (uint j = 0; j < m.mean.size (); j++)
+                out << m.mean[j] << " " << m.m2[j] << "\n";
+            for (std::set<label_t>::const_iterator it = seen.begin (); it != seen.end (); ++it)
+                out << *it << "\n";
+            if (robust)
+                q.write (out);
+            sendMsg (fd, MSG_STATS, out.str ());
+        }
+        else if (type == MSG_NORM && rows.size () > 0)
+        {
+            vecD_t v = fromBytes (payload);
+            vecD_t mu (v.begin (), v.begin () + v.size () / 2);
+            vecD_t prec (v.begin () + v.size () / 2, v.end ());
+            DataHandler normalized (rows, mu, prec);
+            rows = normalized.getTestSetConst ();
+            dataHandlerLabelsToDlib (rows, labels);
+        }
+        else if (type == MSG_TRAIN)
+        {
+            vecD_t v = fromBytes (payload);
+            vec<size_t> f (v.begin () + 3, v.end ());
+            dcd.setPosC (v[0]);
+            dcd.setNegC (v[1]);
+            warm = v[2] != 0;
+            alpha.clear ();
+            if (rows.size () > 0)
+                dataHandlerToRowMajor (rows, f, X);
+        }
+        else if (type == MSG_SOLVE)
+        {
+            center = fromBytes (payload);
+            double rho = center.back ();
+            center.pop_back ();
+            vecD_t w (center);
+            if (X.rows () > 0)
+            {
+                // The duals stay feasible when the center moves
+                if (warm && alpha.size () == X.rows ())
+                    dcd.warmStart (alpha);
+                dcd.setProximal (&center, rho);
+                dcd.train (X, labels);
+                alpha = dcd.getAlpha ();
+                w = dcd.getWeights ();
+                w.push_back (dcd.getBias ());
+            }
+            sendMsg (fd, MSG_WEIGHTS, toBytes (w));
+        }
+    }
+    close (fd);
+    return 0;
+}
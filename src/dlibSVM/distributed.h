@@ -0,0 +1,96 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include "datahandler.h"
+#include "dataconverter.h"
+#include "dcdsolver.h"
+
+typedef enum mixMethod {
+    MIX_ADMM,
+    MIX_AVERAGE
+} MIXMETHOD_t;
+
+/* Data parallel training of the linear SVM over local worker processes
+ *
+ * The coordinator (this object, in the main process) starts N copies of the
+ * running binary in worker mode (see workerMain), each connected to it by a
+ * Unix socket pair. The shards of the training pattern are dealt round-robin
+ * to the workers, every worker reads its shards with DataHandler and keeps
+ * only their labelled rows. No row is ever sent over a socket:
+ * - Normalization: every worker sends the RunningMoments (and with robust
+ *   scaling the FeatureQuantiles) of its rows, the coordinator merges them
+ *   into the statistics of the whole training set and sends back mu / prec.
+ * - Training: consensus ADMM (Boyd et al. 2011, section 8.2) on
+ *
+ *      min_z  0.5 ||z||^2 + sum_k C sum_{i in shard k} hinge (y_i z' x_i)
+ *
+ *   Every iteration each worker solves its shard's problem with the proximal
+ *   term (rho / 2) ||w_k - z + u_k||^2 by dual coordinate descent (see
+ *   DCDSolver::setProximal), warm started from its dual variables of the
+ *   previous iteration, and sends w_k. The coordinator updates the consensus
+ *   z = rho sum (w_k + u_k) / (1 + N rho) and the scaled duals
+ *   u_k += w_k - z. The result is the SVM of all shards. rho is fixed
+ *   for the whole run, [distributed] Rho, 10 by default.
+ * - Or iterative parameter mixing (MIX_AVERAGE): every worker solves its
+ *   shard's problem regularized towards the current mix, (rho / 2)
+ *   ||w_k - z||^2, and z becomes the row weighted average of the w_k. Cheaper
+ *   rounds, but the result only approximates the SVM of all shards.
+ * Both stop when the residuals (the change of z for mixing) fall below the
+ * tolerance, relative to the size of the weights, or after maxIter rounds.
+ * The bias is the last entry of every weight vector.
+ *
+ * Usage:
+ *      DistributedSVM dist;
+ *      dist.start (pattern, workers, threads, robust, clip);
+ *      dist.normalization (mu, prec);
+ *      dist.train (features, Cp, Cn, w, bias);   // for every feature subset
+ * The workers exit when the object is destroyed.
+*/
+class DistributedSVM
+{
+public:
+    DistributedSVM ();
+    ~DistributedSVM ();
+    void setMethod (MIXMETHOD_t m) { method = m; }
+    void setRho (double r) { rho = r; }
+    void setMaxIterations (uint it) { maxIter = it; }
+    void setTolerance (double t) { tol = t; }
+    bool running () const { return fds.size () > 0; }
+    void start (const Str_t &pattern, uint workers, uint threads,
+                bool robust, double clip);
+    void normalization (vecD_t &mu, vecD_t &prec);
+    void train (const vec<size_t> &features, double Cp, double Cn,
+                vecD_t &w, double &bias);
+    void stop ();
+    size_t rows () const { return total; }
+    uint numFeatures () const { return numFeat; }
+    vec<label_t> getClasses () const { return classes; }
+    uint getIterations () const { return iter; }
+    static int workerMain (int fd);
+
+private:
+    void broadcast (uint32_t type, const vecD_t &v);
+    void gather (vec<vecD_t> &v);
+
+    vec<int> fds;
+    vec<int> pids;
+    vecD_t shardRows;
+    size_t total;
+    uint numFeat;
+    vec<label_t> classes;
+    RunningMoments moments;
+    FeatureQuantiles quantiles;
+    bool robust;
+    MIXMETHOD_t method;
+    double rho;
+    uint maxIter;
+    uint iter;
+    double tol;
+};
+
+#endif // DISTRIBUTED_H
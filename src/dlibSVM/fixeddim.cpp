@@ -0,0 +1,16 @@
+#include "fixeddim.h"
+
+/// Fixed dimension model for a subset of 'd' features: the smallest of the
+/// instantiated dimensions that holds it, or NULL to use the dynamic path.
+FixedDimModel * makeFixedDim (size_t d)
+{
+    if (d <= 8)
+        return new FixedDimSVM<8> ();
+    if (d <= 16)
+        return new FixedDimSVM<16> ();
+    if (d <= 32)
+        return new FixedDimSVM<32> ();
+    if (d <= 64)
+        return new FixedDimSVM<64> ();
+    return NULL;
+}
@@ -0,0 +1,162 @@
+#ifndef FIXEDDIM_H
+#define FIXEDDIM_H
+
+#include <vector>
+#include <memory>
+#include <dlib/svm/cross_validate_assignment_trainer.h>
+#include <dlib/svm/svm_c_linear_trainer.h>
+#include "dataconverter.h"
+#include "dcdsolver.h"
+
+/* Runtime interface of the fixed dimension dlib path, see FixedDimSVM
+ *
+ * SVMTestSuite holds one of these for the current feature subset and routes
+ * training, cross validation and scoring of the dlib trainer through it in
+ * place of the dynamically sized 'sample_type' vectors.
+*/
+class FixedDimModel
+{
+public:
+    virtual ~FixedDimModel () {}
+    virtual long dimension () const = 0;
+    virtual void setData (const vecS_t &train, const vecS_t &test,
+                          const vec<size_t> &f) = 0;
+    virtual void train (const vec<label_t> &l, double Cp, double Cn) = 0;
+    virtual void setHyperplane (const vecD &w, double bias) = 0;
+    virtual void hyperplane (vecD &w, double &bias) const = 0;
+    virtual void outOfFoldScores (const vec<label_t> &l, double Cp, double Cn,
+                                  uint nfold, vecD &scores) = 0;
+    virtual void trainScores (vecD &scores) const = 0;
+    virtual void testScores (vecD &scores) const = 0;
+};
+
+/* dlib linear SVM on samples of compile time dimension N
+ *
+ * Samples are dlib::matrix<double, N, 1>: stored inline in the sample vector
+ * (no heap allocation per sample) and the dot products of the linear kernel
+ * have a constant trip count, so the compiler unrolls and vectorizes them.
+ * A subset of d <= N features is zero padded to N, which leaves every dot
+ * product, and hence the trained hyperplane, unchanged.
+*/
+template <long N>
+class FixedDimSVM : public FixedDimModel
+{
+public:
+    typedef dlib::matrix<double, N, 1> sample_type;
+    typedef dlib::linear_kernel<sample_type> kernel_type;
+    typedef dlib::decision_function<kernel_type> dec_funct_type;
+    typedef dlib::normalized_function<dec_funct_type> funct_type;
+
+    FixedDimSVM () : d(0)
+    {
+        // Same identity normalizer as SVMTestSuite::initTrainer, the data
+        // is already normalized by DataHandler
+        sample_type one;
+        one = dlib::ones_matrix<double> (N, 1);
+        vec<sample_type> vw;
+        vw.push_back (one);
+        vw.push_back (one * -1.0);
+        vw.push_back (one * 0.0);
+        learned_function.normalizer.train (vw);
+    }
+
+    long dimension () const { return N; }
+
+    void setData (const vecS_t &train, const vecS_t &test, const vec<size_t> &f)
+    {
+        assert (f.size () <= (size_t) N);
+        d = f.size ();
+        convert (train, f, samples);
+        convert (test, f, testSamples);
+    }
+
+    void train (const vec<label_t> &l, double Cp, double Cn)
+    {
+        trainer.set_c_class1 (Cp);
+        trainer.set_c_class2 (Cn);
+        learned_function.function = trainer.train (samples, l);
+    }
+
+    void setHyperplane (const vecD &w, double bias)
+    {
+        sample_type wv;
+        wv = dlib::zeros_matrix<double> (N, 1);
+        for (size_t j = 0; j < w.size (); j++)
+            wv(j) = w[j];
+        dec_funct_type &df = learned_function.function;
+        df.alpha.set_size (1, 1);
+        df.alpha(0) = 1;
+        df.basis_vectors.set_size (1, 1);
+        df.basis_vectors(0) = wv;
+        df.b = -bias;
+    }
+
+    /// w = sum alpha_i basis_i (first d entries, the rest is padding), bias = -b
+    void hyperplane (vecD &w, double &bias) const
+    {
+        const dec_funct_type &df = learned_function.function;
+        w.assign (d, 0.0);
+        for (long i = 0; i < df.basis_vectors.size (); i++)
+            for (size_t j = 0; j < d; j++)
+                w[j] += df.alpha(i) * df.basis_vectors(i)(j);
+        bias = -df.b;
+    }
+
+    void outOfFoldScores (const vec<label_t> &l, double Cp, double Cn,
+                          uint nfold, vecD &scores)
+    {
+        scores.assign (l.size (), 0.0);
+        dlib::svm_c_linear_trainer<kernel_type> tr = trainer;
+        tr.set_c_class1 (Cp);
+        tr.set_c_class2 (Cn);
+        vec<size_t> rows (l.size ()), trainRows, testRows;
+        for (size_t i = 0; i < rows.size (); i++)
+            rows[i] = i;
+        for (uint k = 0; k < nfold; k++)
+        {
+            classFolds (l, rows, nfold, k, trainRows, testRows);
+            vec<sample_type> s;
+            vec<label_t> y;
+            for (size_t i = 0; i < trainRows.size (); i++)
+            {
+                s.push_back (samples[trainRows[i]]);
+                y.push_back (l[trainRows[i]]);
+            }
+            dec_funct_type df = tr.train (s, y);
+            for (size_t i = 0; i < testRows.size (); i++)
+                scores[testRows[i]] = df(samples[testRows[i]]);
+        }
+    }
+
+    void trainScores (vecD &scores) const { score (samples, scores); }
+    void testScores (vecD &scores) const { score (testSamples, scores); }
+
+private:
+    static void convert (const vecS_t &h, const vec<size_t> &f,
+                         vec<sample_type> &s)
+    {
+        s.resize (h.size ());
+        for (size_t i = 0; i < h.size (); i++)
+        {
+            s[i] = dlib::zeros_matrix<double> (N, 1);
+            for (size_t j = 0; j < f.size (); j++)
+                s[i](j) = h[i][f[j]];
+        }
+    }
+
+    void score (const vec<sample_type> &s, vecD &scores) const
+    {
+        scores.resize (s.size ());
+        for (size_t i = 0; i < s.size (); i++)
+            scores[i] = learned_function(s[i]);
+    }
+
+    size_t d;
+    vec<sample_type> samples, testSamples;
+    dlib::svm_c_linear_trainer<kernel_type> trainer;
+    funct_type learned_function;
+};
+
+FixedDimModel * makeFixedDim (size_t d);
+
+#endif // FIXEDDIM_H
@@ -0,0 +1,145 @@
+#include "gramcache.h"
+
+void GramCache::compute (const vecS_t &x, uint nfold_)
+{
+    assert (x.size () > 0 && nfold_ > 1);
+    nfold = nfold_;
+    D = x[0].size () + 1;
+    n = 0;
+    for (size_t i = 0; i < x.size (); i++)
+        n += x[i].getWeight ();
+    G.assign (nfold, vecD_t (D * D, 0.0));
+    b.assign (nfold, vecD_t (D, 0.0));
+    yy.assign (nfold, 0.0);
+
+    // Stratified fold of every sample
+    vec<uint> fold (x.size ());
+    std::map<label_t, uint> seen;
+    for (size_t i = 0; i < x.size (); i++)
+        fold[i] = seen[x[i].getLabel () > 0 ? 1 : -1]++ % nfold;
+
+    // One contiguous range of blocks and one set of accumulators per thread,
+    // merged in order afterwards
+    const size_t block = 256;
+    const size_t nblocks = (x.size () + block - 1) / block;
+    const size_t nparts = std::min ((size_t) TaskPool::instance ().threads (), nblocks);
+    vec<vec<vecD_t> > Gl (nparts, vec<vecD_t> (nfold, vecD_t (D * D, 0.0)));
+    vec<vec<vecD_t> > bl (nparts, vec<vecD_t> (nfold, vecD_t (D, 0.0)));
+    vec<vecD_t> yyl (nparts, vecD_t (nfold, 0.0));
+    TaskPool::instance ().parallelFor ("gram blocks", 0, nparts, 1, [&] (size_t p) {
+        vecD_t row (D);
+        size_t first = nblocks * p / nparts * block;
+        size_t last = std::min (x.size (), nblocks * (p + 1) / nparts * block);
+        for (size_t i = first; i < last; i++)
+        {
+            vecD_t &Gk = Gl[p][fold[i]];
+            vecD_t &bk = bl[p][fold[i]];
+            double y = (x[i].getLabel () > 0) ? 1.0 : -1.0;
+            double sw = x[i].getWeight ();
+            for (size_t j = 0; j + 1 < D; j++)
+                row[j] = x[i][j];
+            row[D - 1] = 1.0;
+            for (size_t j = 0; j < D; j++)
+            {
+                double rj = sw * row[j];
+                double *Gj = &Gk[j * D];
+                for (size_t l = j; l < D; l++)
+                    Gj[l] += rj * row[l];
+                bk[j] += rj * y;
+            }
+            yyl[p][fold[i]] += sw;
+        }
+    });
+    for (size_t p = 0; p < nparts; p++)
+        for (uint k = 0; k < nfold; k++)
+        {
+            for (size_t j = 0; j < D * D; j++)
+                G[k][j] += Gl[p][k][j];
+            for (size_t j = 0; j < D; j++)
+                b[k][j] += bl[p][k][j];
+            yy[k] += yyl[p][k];
+        }
+
+    Gtot.assign (D * D, 0.0);
+    btot.assign (D, 0.0);
+    yytot = 0;
+    for (uint k = 0; k < nfold; k++)
+    {
+        for (size_t j = 0; j < D * D; j++)
+            Gtot[j] += G[k][j];
+        for (size_t j = 0; j < D; j++)
+            btot[j] += b[k][j];
+        yytot += yy[k];
+    }
+    printf ("- Cached Gram matrices of %lu samples, %lu features, %u folds.\n",
+            x.size (), D - 1, nfold);
+}
+
+/// Mean held-out squared error of the ridge classifier on 'subset' (lower is
+/// better), over all cross validation folds
+double GramCache::crossValidate (const vec<size_t> &subset) const
+{
+    assert (!empty ());
+    const size_t m = subset.size () + 1;
+    vec<size_t> idx (subset);
+    idx.push_back (D - 1);      // intercept
+    vecD_t A (m * m), w (m);
+    double sse = 0;
+    for (uint k = 0; k < nfold; k++)
+    {
+        for (size_t r = 0; r < m; r++)
+        {
+            for (size_t c = 0; c < m; c++)
+                A[r * m + c] = g (Gtot, idx[r], idx[c]) - g (G[k], idx[r], idx[c]);
+            if (r + 1 < m)
+                A[r * m + r] += lambda;
+            w[r] = btot[idx[r]] - b[k][idx[r]];
+        }
+        if (!solve (A, w, m))
+            return std::numeric_limits<double>::infinity ();
+        double e = yy[k];
+        for (size_t r = 0; r < m; r++)
+        {
+            e -= 2 * w[r] * b[k][idx[r]];
+            for (size_t c = 0; c < m; c++)
+                e += w[r] * g (G[k], idx[r], idx[c]) * w[c];
+        }
+        sse += e;
+    }
+    return sse / n;
+}
+
+/// Solve A x = b by Cholesky decomposition, A is m x m SPD; x holds b on
+/// entry and the solution on return, A is overwritten by its factor
+bool GramCache::solve (vecD_t &A, vecD_t &x, size_t m)
+{
+    for (size_t j = 0; j < m; j++)
+    {
+        double s = A[j * m + j];
+        for (size_t k = 0; k < j; k++)
+            s -= A[j * m + k] * A[j * m + k];
+        if (s <= 0)
+            return false;
+        A[j * m + j] = std::sqrt (s);
+        for (size_t i = j + 1; i < m; i++)
+        {
+            double t = A[i * m + j];
+            for (size_t k = 0; k < j; k++)
+                t -= A[i * m + k] * A[j * m + k];
+            A[i * m + j] = t / A[j * m + j];
+        }
+    }
+    for (size_t i = 0; i < m; i++)
+    {
+        for (size_t k = 0; k < i; k++)
+            x[i] -= A[i * m + k] * x[k];
+        x[i] /= A[i * m + i];
+    }
+    for (size_t i = m; i-- > 0; )
+    {
+        for (size_t k = i + 1; k < m; k++)
+            x[i] -= A[k * m + i] * x[k];
+        x[i] /= A[i * m + i];
+    }
+    return true;
+}
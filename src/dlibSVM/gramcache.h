@@ -0,0 +1,53 @@
+#ifndef GRAMCACHE_H
+#define GRAMCACHE_H
+
+#include <vector>
+#include <cmath>
+#include "datahandler.h"
+
+typedef vec<double> vecD_t;
+
+/* Cached Gram matrices for fast screening of feature subsets
+ *
+ * One pass over the (normalized) training set accumulates, for every cross
+ * validation fold k, the statistics G_k = X_k' X_k, b_k = X_k' y and y_k' y_k
+ * of the samples in that fold, with a constant 1 appended to every sample for
+ * the intercept. Folds are stratified: the i-th sample of a class goes to fold
+ * i % nfold. The pass is blocked over rows and parallel (TaskPool). Samples
+ * count with their weight (see DataHandler::deduplicate).
+ *
+ * A feature subset S is then scored by a ridge regression classifier on the
+ * +1/-1 labels (for two classes the direction of Fisher's LDA): for every
+ * fold the training statistics are the totals minus the fold, the model is
+ * the solution of the small system (G_SS + lambda I) w = b_S, and the held-out
+ * squared error is y_k' y_k - 2 w' b_k,S + w' G_k,SS w. Nothing touches the
+ * samples again, so scoring a subset costs O(nfold |S|^3) whatever the number
+ * of samples.
+*/
+class GramCache
+{
+public:
+    GramCache () : D(0), nfold(0), lambda(1.0), n(0) {}
+    void compute (const vecS_t &x, uint nfold_);
+    void setLambda (double l) { lambda = l; }
+    bool empty () const { return D == 0; }
+    double crossValidate (const vec<size_t> &subset) const;
+
+private:
+    inline double g (const vecD_t &G, size_t i, size_t j) const
+    { return (i <= j) ? G[i * D + j] : G[j * D + i]; }
+    static bool solve (vecD_t &A, vecD_t &x, size_t m);
+
+    size_t D;
+    uint nfold;
+    double lambda;
+    double n;
+    vec<vecD_t> G;      // per fold, upper triangle of D x D, row-major
+    vec<vecD_t> b;      // per fold, D
+    vecD_t yy;          // per fold
+    vecD_t Gtot;
+    vecD_t btot;
+    double yytot;
+};
+
+#endif // GRAMCACHE_H
@@ -0,0 +1,170 @@
+#include "incrementalstate.h"
+
+static void writeVector (std::ofstream &f, const Str_t &name, const vecD_t &x)
+{
+    f << name << " " << x.size ();
+    for (size_t i = 0; i < x.size (); i++)
+        f << " " << x[i];
+    f << "\n";
+}
+
+static void readVector (std::istream &f, vecD_t &x)
+{
+    Str_t name;
+    size_t n = 0;
+    f >> name >> n;
+    x.resize (n);
+    for (size_t i = 0; i < n; i++)
+        f >> x[i];
+}
+
+bool IncrementalState::load (const Str_t &filename)
+{
+    std::ifstream f(filename);
+    if (!f.is_open ())
+        return false;
+    Str_t word, line;
+    size_t nrows = 0, nmodels = 0;
+    f >> word >> offset;
+    f >> word >> moments.n;
+    readVector (f, moments.mean);
+    readVector (f, moments.m2);
+    f >> word >> nrows;
+    std::getline (f, line);
+    retained.resize (nrows);
+    for (size_t i = 0; i < nrows; i++)
+    {
+        std::getline (f, line);
+        std::stringstream ss (line.substr (0, line.find_first_of ('#')));
+        label_t lab;
+        ss >> lab;
+        retained[i].push_lab (lab);
+        while (ss >> word)
+            retained[i].push_back (std::stod (word.substr (word.find (':') + 1)));
+        if (line.find_first_of ('#') != Str_t::npos)
+            retained[i].push_comment (line.substr (line.find_first_of ('#') + 2));
+    }
+    f >> word >> nmodels;
+    models.resize (nmodels);
+    for (size_t m = 0; m < nmodels; m++)
+    {
+        size_t nalpha = 0, idx;
+        double a;
+        f >> word >> models[m].key;
+        f >> word >> models[m].C1 >> models[m].C2;
+        f >> word >> models[m].acc;
+        f >> word >> models[m].bias;
+        f >> word >> models[m].threshold;
+        readVector (f, models[m].w);
+        f >> word >> nalpha;
+        for (size_t k = 0; k < nalpha; k++)
+        {
+            f >> idx >> a;
+            models[m].alpha[idx] = a;
+        }
+    }
+    bool ok = !f.fail ();
+    // Optional, states written without feature hashing have no hashing line
+    // and those without robust scaling no sketches
+    hashBits = 0;
+    hashSeed = 0;
+    if (f >> std::ws && f.peek () == 'h')
+        ok = (f >> word >> hashBits >> hashSeed) && ok;
+    if (f >> std::ws && f.peek () == 'q')
+        ok = quantiles.read (f) && ok;
+    printf ("- Loaded incremental state %s: %lu retained rows, %lu models.\n",
+            filename.c_str (), retained.size (), models.size ());
+    return ok;
+}
+
+bool IncrementalState::save (const Str_t &filename) const
+{
+    std::ofstream f(filename);
+    if (!f.is_open ())
+    {
+        std::cout << "Error writing file: " << filename << "\n";
+        return false;
+    }
+    f << std::setprecision (17);
+    f << "offset " << offset << "\n";
+    f << "samples " << moments.n << "\n";
+    writeVector (f, "mean", moments.mean);
+    writeVector (f, "m2", moments.m2);
+    f << "retained " << retained.size () << "\n";
+    for (size_t i = 0; i < retained.size (); i++)
+    {
+        f << retained[i].getLabel ();
+        for (size_t j = 0; j < retained[i].size (); j++)
+            f << " " << j + 1 << ":" << retained[i][j];
+        f << " # " << retained[i].getComments () << "\n";
+    }
+    f << "models " << models.size () << "\n";
+    for (size_t m = 0; m < models.size (); m++)
+    {
+        f << "key " << models[m].key << "\n";
+        f << "C " << models[m].C1 << " " << models[m].C2 << "\n";
+        f << "acc " << models[m].acc << "\n";
+        f << "bias " << models[m].bias << "\n";
+        f << "threshold " << models[m].threshold << "\n";
+        writeVector (f, "w", models[m].w);
+        f << "alpha " << models[m].alpha.size ();
+        std::map<size_t, double>::const_iterator it;
+        for (it = models[m].alpha.begin (); it != models[m].alpha.end (); ++it)
+            f << " " << it->first << " " << it->second;
+        f << "\n";
+    }
+    if (hashBits > 0)
+        f << "hashing " << hashBits << " " << hashSeed << "\n";
+    if (!quantiles.empty ())
+        quantiles.write (f);
+    return true;
+}
+
+LinearModelState * IncrementalState::find (const Str_t &key)
+{
+    for (size_t m = 0; m < models.size (); m++)
+        if (models[m].key == key)
+            return &models[m];
+    return NULL;
+}
+
+void IncrementalState::update (const LinearModelState &m)
+{
+    LinearModelState *p = find (m.key);
+    if (p)
+        *p = m;
+    else
+        models.push_back (m);
+}
+
+/// Keep the rows of 'rows' that have a non-zero dual variable in any model
+/// and renumber the dual variables of every model accordingly
+void IncrementalState::retainSupportVectors (const vecS_t &rows)
+{
+    std::map<size_t, size_t> newIndex;
+    for (size_t m = 0; m < models.size (); m++)
+    {
+        std::map<size_t, double>::const_iterator it;
+        for (it = models[m].alpha.begin (); it != models[m].alpha.end (); ++it)
+            if (it->second > 0)
+                newIndex[it->first] = 0;
+    }
+    retained.clear ();
+    std::map<size_t, size_t>::iterator itN;
+    for (itN = newIndex.begin (); itN != newIndex.end (); ++itN)
+    {
+        itN->second = retained.size ();
+        retained.push_back (rows[itN->first]);
+    }
+    for (size_t m = 0; m < models.size (); m++)
+    {
+        std::map<size_t, double> alpha;
+        std::map<size_t, double>::const_iterator it;
+        for (it = models[m].alpha.begin (); it != models[m].alpha.end (); ++it)
+            if (it->second > 0)
+                alpha[newIndex[it->first]] = it->second;
+        models[m].alpha = alpha;
+    }
+    printf ("- Retained %lu support vectors for the next incremental run.\n",
+            retained.size ());
+}
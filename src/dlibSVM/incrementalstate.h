@@ -0,0 +1,68 @@
+#ifndef INCREMENTALSTATE_H
+#define INCREMENTALSTATE_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include "datahandler.h"
+
+typedef vec<double> vecD_t;
+
+/// Linear model of one test case (feature subset) kept between incremental runs
+struct LinearModelState
+{
+    LinearModelState () : C1(0), C2(0), acc(0), bias(0), threshold(0) {}
+
+    Str_t key;
+    double C1;
+    double C2;
+    double acc;
+    double bias;
+    double threshold;
+    vecD_t w;
+    std::map<size_t, double> alpha;     // row of 'retained' -> dual variable
+};
+
+/* State of an incrementally trained feature file
+ *
+ * Saved between runs so that the next run only has to read the rows appended
+ * to the feature file since the last one:
+ * - offset :   byte offset in the feature file up to which rows were consumed
+ * - moments :  running moments of all labelled rows consumed so far
+ * - retained : raw (unnormalized) rows that are support vectors of at least
+ *              one model. The other rows are dropped, so the training set of
+ *              the next run is the retained rows plus the new rows. This is
+ *              an approximation: dropped rows do not change the old solution,
+ *              but once new rows move w some of them may violate the margin,
+ *              and the retrained model is not the SVM of all rows.
+ * - models :   C1/C2, the accuracy used for drift detection, weights and the
+ *              dual variables of the retained rows for warm starting
+ * - quantiles : with robust scaling, the feature quantile sketches of all
+ *              labelled rows consumed so far
+ * - hashing :  with feature hashing, the bits and seed the rows and models
+ *              were hashed with; later runs read the file with the same ones
+ *
+ * The file is plain text, retained rows are stored in SVMLight format.
+*/
+class IncrementalState
+{
+public:
+    IncrementalState () : offset(0), hashBits(0), hashSeed(0) {}
+    bool load (const Str_t &filename);
+    bool save (const Str_t &filename) const;
+    LinearModelState * find (const Str_t &key);
+    void update (const LinearModelState &m);
+    void retainSupportVectors (const vecS_t &rows);
+
+    std::streamoff offset;
+    RunningMoments moments;
+    vecS_t retained;
+    vec<LinearModelState> models;
+    FeatureQuantiles quantiles;
+    uint hashBits;
+    uint64_t hashSeed;
+};
+
+#endif // INCREMENTALSTATE_H
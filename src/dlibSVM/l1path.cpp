@@ -0,0 +1,233 @@
+#include "l1path.h"
+
+L1PathSolver::L1PathSolver () :
+    Cp(1.0),
+    Cn(1.0),
+    l1Ratio(1.0),
+    eps(1e-3),
+    maxIter(1000),
+    weights(NULL)
+{}
+
+/// Fit the bias alone on the current margins (steps on the quadratic bound
+/// 'hb' of the loss), updates the margins and returns the new bias
+double L1PathSolver::fitBias (const vec<signed char> &yi, const vecD &c,
+                              double hb, vecD &margin, double bias) const
+{
+    for (uint it = 0; it < 100; it++)
+    {
+        double g = 0;
+        for (size_t s = 0; s < margin.size (); s++)
+            if (margin[s] < 1)
+                g -= c[s] * yi[s] * (1 - margin[s]);
+        double delta = -g / hb;
+        for (size_t s = 0; s < margin.size (); s++)
+            margin[s] += yi[s] * delta;
+        bias += delta;
+        if (std::fabs (delta) * std::sqrt (hb) <= eps)
+            break;
+    }
+    return bias;
+}
+
+/// Smallest lambda for which all weights are 0: the largest gradient of the
+/// loss at w = 0 (bias fitted) over the L1 ratio
+double L1PathSolver::lambdaMax (const FeatureMatrix &X, const LabelView &y,
+                                const vec<size_t> &rows) const
+{
+    const size_t l = rows.size (), d = X.cols ();
+    vec<signed char> yi (l);
+    vecD c (l), margin (l, 0.0), g (d, 0.0);
+    double hb = 0;
+    for (size_t s = 0; s < l; s++)
+    {
+        yi[s] = y[rows[s]];
+        c[s] = ((yi[s] > 0) ? Cp : Cn) * sampleWeight (rows[s]) * 2.0 / l;
+        hb += c[s];
+    }
+    fitBias (yi, c, hb, margin, 0.0);
+    for (size_t s = 0; s < l; s++)
+    {
+        if (margin[s] >= 1)
+            continue;
+        const feature_t *x = X.row (rows[s]);
+        for (size_t j = 0; j < d; j++)
+            g[j] -= c[s] * yi[s] * x[j] * (1 - margin[s]);
+    }
+    double gmax = 0;
+    for (size_t j = 0; j < d; j++)
+        gmax = std::max (gmax, std::fabs (g[j]));
+    return gmax / l1Ratio;
+}
+
+/// 'length' lambdas from lambdaMax down to ratio * lambdaMax, geometrically
+vecD L1PathSolver::makeLambdas (double lambdaMax, uint length, double ratio)
+{
+    vecD l (std::max (1u, length));
+    for (size_t k = 0; k < l.size (); k++)
+        l[k] = lambdaMax * ((l.size () > 1) ? std::pow (ratio, k / (l.size () - 1.0)) : ratio);
+    return l;
+}
+
+void L1PathSolver::fitPath (const FeatureMatrix &X, const LabelView &y,
+                            const vec<size_t> &rows, vec<PathPoint> &path) const
+{
+    assert (rows.size () > 0 && lambdas.size () > 0);
+    const size_t l = rows.size (), d = X.cols ();
+    vec<vecD> col (d, vecD (l));
+    vec<signed char> yi (l);
+    vecD c (l), H (d, 0.0), margin (l, 0.0), w (d, 0.0);
+    double hb = 0;
+    for (size_t s = 0; s < l; s++)
+    {
+        const feature_t *x = X.row (rows[s]);
+        yi[s] = y[rows[s]];
+        c[s] = ((yi[s] > 0) ? Cp : Cn) * sampleWeight (rows[s]) * 2.0 / l;
+        hb += c[s];
+        for (size_t j = 0; j < d; j++)
+        {
+            col[j][s] = x[j];
+            H[j] += c[s] * x[j] * x[j];
+        }
+    }
+    double bias = fitBias (yi, c, hb, margin, 0.0);
+
+    bool maxed = false;
+    path.resize (lambdas.size ());
+    for (size_t p = 0; p < lambdas.size (); p++)
+    {
+        const double l1 = lambdas[p] * l1Ratio, l2 = lambdas[p] * (1.0 - l1Ratio);
+        bool full = true;
+        uint it;
+        for (it = 0; it < maxIter; it++)
+        {
+            double maxChange = 0;
+            for (size_t j = 0; j < d; j++)
+            {
+                if ((!full && w[j] == 0) || H[j] == 0)
+                    continue;
+                const vecD &xj = col[j];
+                double g = 0;
+                for (size_t s = 0; s < l; s++)
+                    if (margin[s] < 1)
+                        g -= c[s] * yi[s] * xj[s] * (1 - margin[s]);
+                // Minimize g d + (H_j + l2) / 2 d^2 + l2 w_j d + l1 |w_j + d|
+                double h = H[j] + l2, z = H[j] * w[j] - g;
+                double wn = (z > l1) ? (z - l1) / h : (z < -l1) ? (z + l1) / h : 0.0;
+                double delta = wn - w[j];
+                if (delta == 0)
+                    continue;
+                for (size_t s = 0; s < l; s++)
+                    margin[s] += yi[s] * xj[s] * delta;
+                w[j] = wn;
+                maxChange = std::max (maxChange, std::fabs (delta) * std::sqrt (h));
+            }
+            bias = fitBias (yi, c, hb, margin, bias);
+            // Converged on the active features, verify on all of them
+            if (maxChange <= eps && full)
+                break;
+            full = maxChange <= eps;
+        }
+        maxed = maxed || it >= maxIter;
+        path[p].lambda = lambdas[p];
+        path[p].w = w;
+        path[p].bias = bias;
+        path[p].active = d - std::count (w.begin (), w.end (), 0.0);
+    }
+    if (maxed)
+        printf ("- L1PathSolver: reached max number of iterations %u.\n", maxIter);
+}
+
+SparseLinearModel::SparseLinearModel (const vecD_t &w, double bias_,
+                                      const vec<size_t> &f) :
+    bias(bias_)
+{
+    assert (w.size () == f.size ());
+    for (size_t j = 0; j < w.size (); j++)
+        if (w[j] != 0)
+        {
+            col.push_back (f[j]);
+            weight.push_back (w[j]);
+        }
+}
+
+/// The same model on raw samples, normalized as (x - mu) prec: the
+/// normalization is folded into the weights and the bias
+SparseLinearModel SparseLinearModel::folded (const vecD_t &mu, const vecD_t &prec) const
+{
+    SparseLinearModel m (*this);
+    for (size_t k = 0; k < col.size (); k++)
+    {
+        m.weight[k] *= prec[col[k]];
+        m.bias -= m.weight[k] * mu[col[k]];
+    }
+    return m;
+}
+
+/* nfold cross validation of the whole path of 's' (its lambdas) on the given
+ * rows of X, folds as in dcdCrossValidate (see classFolds), one task of the
+ * pool per fold. accPos / accNeg receive the fraction of correctly
+ * classified +1 / -1 samples (weighted) for every lambda, 'oof' the
+ * out-of-fold score of every row for every lambda. Returns the number of
+ * training samples processed over all folds.
+*/
+size_t l1CrossValidatePath (const L1PathSolver &s, const FeatureMatrix &X,
+                            const LabelView &y, const vec<size_t> &rows,
+                            uint nfold, vecD &accPos, vecD &accNeg,
+                            vec<vecD> *oof)
+{
+    const size_t np = s.lambdaCount ();
+    vec<vecD> fpos (nfold, vecD (np, 0.0)), fneg (nfold, vecD (np, 0.0));
+    vecD tpos (nfold, 0.0), tneg (nfold, 0.0);
+    vec<size_t> trained (nfold, 0);
+    if (oof != NULL)
+        oof->assign (np, vecD (X.rows (), 0.0));
+    TaskPool::instance ().parallelFor ("l1 cv fold", 0, nfold, 1, [&] (size_t k) {
+        vec<PathPoint> path;
+        vec<size_t> trainRows, testRows;
+        classFolds (y, rows, nfold, k, trainRows, testRows);
+        s.fitPath (X, y, trainRows, path);
+        trained[k] = trainRows.size ();
+        for (size_t i = 0; i < testRows.size (); i++)
+        {
+            const feature_t *x = X.row (testRows[i]);
+            double w = s.sampleWeight (testRows[i]);
+            bool pos = y[testRows[i]] > 0;
+            (pos ? tpos[k] : tneg[k]) += w;
+            for (size_t p = 0; p < path.size (); p++)
+            {
+                double f = path[p].bias;
+                for (size_t j = 0; j < path[p].w.size (); j++)
+                    f += path[p].w[j] * x[j];
+                if (oof != NULL)
+                    (*oof)[p][testRows[i]] = f;
+                if (pos)
+                    fpos[k][p] += w * (f >= 0);
+                else
+                    fneg[k][p] += w * (f < 0);
+            }
+        }
+    });
+    vecD cpos (np, 0.0), cneg (np, 0.0);
+    double tp = 0, tn = 0;
+    size_t evaluations = 0;
+    for (uint k = 0; k < nfold; k++)
+    {
+        for (size_t p = 0; p < np; p++)
+        {
+            cpos[p] += fpos[k][p];
+            cneg[p] += fneg[k][p];
+        }
+        tp += tpos[k];
+        tn += tneg[k];
+        evaluations += trained[k];
+    }
+    accPos.resize (cpos.size ());
+    accNeg.resize (cneg.size ());
+    for (size_t p = 0; p < cpos.size (); p++)
+    {
+        accPos[p] = cpos[p] / tp;
+        accNeg[p] = cneg[p] / tn;
+    }
+    return evaluations;
+}
@@ -0,0 +1,110 @@
+#ifndef L1PATH_H
+#define L1PATH_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "dataconverter.h"
+#include "dcdsolver.h"
+
+/// One model of a regularization path
+struct PathPoint
+{
+    PathPoint () : lambda(0), bias(0), active(0) {}
+    double lambda;
+    vecD w;
+    double bias;
+    size_t active;      // number of non-zero weights
+};
+
+/* Elastic-net regularized L2-loss (squared hinge) linear SVM, trained along
+ * a regularization path by coordinate descent
+ *
+ *      min_w,b  lambda sum_j (a |w_j| + (1 - a) / 2 w_j^2)
+ *               + 1/n sum_i c_i max (0, 1 - y_i (w' x_i + b))^2
+ *
+ * a = 1 is the lasso (L1) and a < 1 the elastic net, c_i = Cp or Cn times the
+ * sample weight. The bias is not regularized.
+ *
+ * Every coordinate step minimizes the quadratic upper bound of the loss given
+ * by H_j = 2/n sum_i c_i x_ij^2 (the gradient of the squared hinge is
+ * Lipschitz), so it is a soft thresholding in closed form that never
+ * increases the objective, no line search is needed. The margins y_i f(x_i)
+ * are kept up to date, a step costs O(n) on a column-major copy of the rows.
+ *
+ * The path starts at lambdaMax, the smallest lambda with w = 0, and goes down
+ * geometrically to ratio * lambdaMax; every model warm starts the next one.
+ * Per lambda, sweeps over all features alternate with sweeps over the active
+ * (non-zero) ones until a full sweep changes no weight by more than eps
+ * (scaled by sqrt (H_j)).
+ *
+ * Usage:
+ * - Set Cs, the L1 ratio a and the path (length, ratio), call lambdaMax on the
+ *   full training set and setLambdas with the grid built from it (see
+ *   makeLambdas) so every fold of a cross validation uses the same grid.
+ * - fitPath returns one PathPoint per lambda.
+*/
+class L1PathSolver
+{
+public:
+    L1PathSolver ();
+    void setPosC (double C_) { Cp = C_; }
+    void setNegC (double C_) { Cn = C_; }
+    void setL1Ratio (double a) { l1Ratio = std::min (1.0, std::max (1e-3, a)); }
+    void setEpsilon (double e) { eps = e; }
+    void setMaxIterations (uint it) { maxIter = it; }
+    void setSampleWeights (const vecD *sw) { weights = sw; }
+    inline double sampleWeight (size_t row) const
+    { return (weights != NULL) ? (*weights)[row] : 1.0; }
+    double lambdaMax (const FeatureMatrix &X, const LabelView &y,
+                      const vec<size_t> &rows) const;
+    static vecD makeLambdas (double lambdaMax, uint length, double ratio);
+    void setLambdas (const vecD &l) { lambdas = l; }
+    size_t lambdaCount () const { return lambdas.size (); }
+    void fitPath (const FeatureMatrix &X, const LabelView &y,
+                  const vec<size_t> &rows, vec<PathPoint> &path) const;
+
+private:
+    double fitBias (const vec<signed char> &yi, const vecD &c, double hb,
+                    vecD &margin, double bias) const;
+
+    double Cp;
+    double Cn;
+    double l1Ratio;
+    double eps;
+    uint maxIter;
+    const vecD *weights;
+    vecD lambdas;
+};
+
+/* Linear model as a list of its non-zero weights
+ *
+ * Built from a dense hyperplane over the feature subset 'f' (e.g. the result
+ * of L1PathSolver), keeps the sample column and weight of every non-zero
+ * weight only. Scoring a sample touches the active features and nothing else.
+*/
+struct SparseLinearModel
+{
+    SparseLinearModel () : bias(0) {}
+    SparseLinearModel (const vecD_t &w, double bias_, const vec<size_t> &f);
+    inline double score (const sample_t &x) const
+    {
+        double s = bias;
+        for (size_t k = 0; k < col.size (); k++)
+            s += weight[k] * x[col[k]];
+        return s;
+    }
+    size_t active () const { return col.size (); }
+    SparseLinearModel folded (const vecD_t &mu, const vecD_t &prec) const;
+
+    vec<size_t> col;
+    vecD_t weight;
+    double bias;
+};
+
+size_t l1CrossValidatePath (const L1PathSolver &s, const FeatureMatrix &X,
+                            const LabelView &y, const vec<size_t> &rows,
+                            uint nfold, vecD &accPos, vecD &accNeg,
+                            vec<vecD> *oof = NULL);
+
+#endif // L1PATH_H
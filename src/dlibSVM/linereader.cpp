@@ -0,0 +1,257 @@
+#include "linereader.h"
+#include "taskpool.h"
+
+static bool endsWith (const Str_t &s, const Str_t &suffix)
+{
+    return s.size () >= suffix.size () &&
+           s.compare (s.size () - suffix.size (), suffix.size (), suffix) == 0;
+}
+
+LineReader::LineReader () :
+    format(PLAIN),
+    opened(false),
+    gz(NULL),
+    zf(NULL),
+#ifdef HAVE_ZSTD
+    zds(NULL),
+    zret(0),
+#endif
+    stop(false),
+    cur(0),
+    pos(0),
+    haveBlock(false),
+    eof(false),
+    consumed(0)
+{
+    len[0] = len[1] = 0;
+    full[0] = full[1] = false;
+}
+
+LineReader::~LineReader ()
+{
+    close ();
+}
+
+bool LineReader::open (const Str_t &filename, std::streamoff offset)
+{
+    close ();
+    consumed = 0;
+    name = filename;
+    if (endsWith (filename, ".gz"))
+    {
+        format = GZIP;
+        gz = gzopen (filename.c_str (), "rb");
+        if (gz == NULL)
+            return false;
+        gzbuffer (gz, 1 << 17);
+    }
+    else if (endsWith (filename, ".zst"))
+    {
+#ifdef HAVE_ZSTD
+        format = ZSTD;
+        zf = fopen (filename.c_str (), "rb");
+        if (zf == NULL)
+            return false;
+        zds = ZSTD_createDStream ();
+        ZSTD_initDStream (zds);
+        zin.resize (ZSTD_DStreamInSize ());
+        zinBuf.src = &zin[0];
+        zinBuf.size = 0;
+        zinBuf.pos = 0;
+        zret = 0;
+#else
+        std::cout << "Reading " << filename << " needs a build with HAVE_ZSTD.\n";
+        return false;
+#endif
+    }
+    else
+    {
+        format = PLAIN;
+        plain.open (filename);
+        if (!plain.is_open ())
+            return false;
+        plain.seekg (offset);
+        consumed = offset;
+        opened = true;
+        return true;
+    }
+
+    block[0].resize (BLOCK_SIZE);
+    block[1].resize (BLOCK_SIZE);
+    len[0] = len[1] = 0;
+    full[0] = full[1] = false;
+    stop = false;
+    cur = 0;
+    pos = 0;
+    haveBlock = false;
+    eof = false;
+    opened = true;
+    worker = std::thread (&LineReader::decompressLoop, this);
+
+    // Compressed streams cannot seek, skip 'offset' decompressed bytes
+    while (consumed < offset && nextBlock ())
+    {
+        size_t skip = std::min ((size_t) (offset - consumed), len[cur] - pos);
+        pos += skip;
+        consumed += skip;
+    }
+    return true;
+}
+
+void LineReader::close ()
+{
+    if (worker.joinable ())
+    {
+        {
+            std::lock_guard<std::mutex> lock (m);
+            stop = true;
+        }
+        cv.notify_all ();
+        worker.join ();
+    }
+    if (plain.is_open ())
+        plain.close ();
+    if (gz != NULL)
+        gzclose (gz);
+    gz = NULL;
+    if (zf != NULL)
+        fclose (zf);
+    zf = NULL;
+#ifdef HAVE_ZSTD
+    if (zds != NULL)
+        ZSTD_freeDStream (zds);
+    zds = NULL;
+#endif
+    opened = false;
+}
+
+/// Decompressor thread: fill the two blocks alternately until end of input
+void LineReader::decompressLoop ()
+{
+    // Opened by a pinned pool worker, do not share its CPU with the parser
+    TaskPool::unpin ();
+    int b = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock (m);
+            cv.wait (lock, [&] { return !full[b] || stop; });
+            if (stop)
+                return;
+        }
+        size_t n = decompressBlock (&block[b][0], BLOCK_SIZE);
+        {
+            std::lock_guard<std::mutex> lock (m);
+            len[b] = n;
+            full[b] = true;
+        }
+        cv.notify_all ();
+        if (n == 0)
+            return;
+        b ^= 1;
+    }
+}
+
+/// Decompress up to 'cap' bytes into 'buf', 0 at end of input. Corrupt or
+/// truncated input stops the program.
+size_t LineReader::decompressBlock (char *buf, size_t cap)
+{
+    if (format == GZIP)
+    {
+        int n = gzread (gz, buf, cap);
+        int err = Z_OK;
+        if (n <= 0)
+            gzerror (gz, &err);
+        // Z_BUF_ERROR: the file ends inside a gzip stream
+        assert ((n >= 0 && err == Z_OK) ||
+                !(std::cout << "Corrupt or truncated gzip file " << name << " ("
+                            << ((err == Z_BUF_ERROR) ? "unexpected end of file" : zError (err))
+                            << ")" << std::endl));
+        return (n > 0) ? (size_t) n : 0;
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_outBuffer out = { buf, cap, 0 };
+    while (out.pos < out.size)
+    {
+        if (zinBuf.pos == zinBuf.size)
+        {
+            zinBuf.size = fread (&zin[0], 1, zin.size (), zf);
+            zinBuf.pos = 0;
+            if (zinBuf.size == 0 && zret != 0)
+            {
+                // No input left: flush what the decoder still holds, a
+                // frame that stays unfinished was cut off
+                size_t before = out.pos;
+                zret = ZSTD_decompressStream (zds, &out, &zinBuf);
+                assert ((!ZSTD_isError (zret) && (zret == 0 || out.pos > before)) ||
+                        !(std::cout << "Corrupt or truncated zstd file " << name << std::endl));
+                continue;
+            }
+            if (zinBuf.size == 0)
+                break;
+        }
+        zret = ZSTD_decompressStream (zds, &out, &zinBuf);
+        assert (!ZSTD_isError (zret) ||
+                !(std::cout << "Corrupt zstd file " << name << ": "
+                            << ZSTD_getErrorName (zret) << std::endl));
+    }
+    return out.pos;
+#else
+    return 0;
+#endif
+}
+
+/// Make sure block 'cur' has unread bytes, false at end of input
+bool LineReader::nextBlock ()
+{
+    if (haveBlock && pos < len[cur])
+        return true;
+    if (eof)
+        return false;
+    if (haveBlock)
+    {
+        // Hand the consumed block back to the decompressor
+        {
+            std::lock_guard<std::mutex> lock (m);
+            full[cur] = false;
+        }
+        cv.notify_all ();
+        cur ^= 1;
+    }
+    std::unique_lock<std::mutex> lock (m);
+    cv.wait (lock, [&] { return full[cur]; });
+    haveBlock = true;
+    pos = 0;
+    eof = (len[cur] == 0);
+    return !eof;
+}
+
+bool LineReader::getline (Str_t &line)
+{
+    if (format == PLAIN)
+    {
+        if (!std::getline (plain, line, '\n'))
+            return false;
+        consumed += line.size () + (plain.eof () ? 0 : 1);
+        return true;
+    }
+    line.clear ();
+    bool any = false;
+    while (nextBlock ())
+    {
+        const char *b = &block[cur][0];
+        const char *nl = (const char *) memchr (b + pos, '\n', len[cur] - pos);
+        size_t end = (nl != NULL) ? nl - b : len[cur];
+        line.append (b + pos, end - pos);
+        consumed += end - pos;
+        pos = end;
+        any = true;
+        if (nl != NULL)
+        {
+            pos++;
+            consumed++;
+            return true;
+        }
+    }
+    return any;
+}
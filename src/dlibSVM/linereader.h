@@ -0,0 +1,87 @@
+#ifndef LINEREADER_H
+#define LINEREADER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+typedef std::string Str_t;
+
+/* Line by line reader for feature files, transparently decompressing input
+ *
+ * Plain files are read with std::ifstream. Files ending in '.gz' (zlib) or
+ * '.zst' (libzstd, build with HAVE_ZSTD) are decompressed by a separate
+ * thread into two blocks of BLOCK_SIZE bytes: while the caller parses the
+ * lines of one block, the decompressor fills the other one, so the CPU cost
+ * of decompression overlaps with parsing and no temporary file is needed.
+ *
+ * A corrupt or truncated compressed file stops the program with a message,
+ * it is never read as a shorter file.
+ *
+ * Offsets ('offset' in open, tell) count bytes of the decompressed stream, so
+ * they mean the same for plain and compressed versions of a file.
+ *
+ * Usage:
+ *      LineReader f;
+ *      if (f.open (filename))
+ *          while (f.getline (line)) ...
+*/
+class LineReader
+{
+public:
+    LineReader ();
+    ~LineReader ();
+    bool open (const Str_t &filename, std::streamoff offset = 0);
+    bool is_open () const { return opened; }
+    bool getline (Str_t &line);
+    std::streamoff tell () const { return consumed; }
+    void close ();
+
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+private:
+    typedef enum { PLAIN, GZIP, ZSTD } format_t;
+
+    void decompressLoop ();
+    size_t decompressBlock (char *buf, size_t cap);
+    bool nextBlock ();
+
+    format_t format;
+    Str_t name;
+    bool opened;
+    std::ifstream plain;
+    gzFile gz;
+    FILE *zf;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zds;
+    std::vector<char> zin;
+    ZSTD_inBuffer zinBuf;
+    size_t zret;        // last ZSTD_decompressStream, 0 at a frame end
+#endif
+    std::thread worker;
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<char> block[2];
+    size_t len[2];
+    bool full[2];
+    bool stop;
+    int cur;
+    size_t pos;
+    bool haveBlock;
+    bool eof;
+    std::streamoff consumed;
+};
+
+#endif // LINEREADER_H
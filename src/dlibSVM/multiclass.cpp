@@ -0,0 +1,89 @@
+#include "multiclass.h"
+
+void OneVsRestSVM::train (const FeatureMatrix &X, const vec<label_t> &y)
+{
+    vec<size_t> rows (X.rows ());
+    for (size_t i = 0; i < rows.size (); i++)
+        rows[i] = i;
+    train (X, y, rows);
+}
+
+void OneVsRestSVM::train (const FeatureMatrix &X, const vec<label_t> &y,
+                          const vec<size_t> &rows)
+{
+    assert (classes.size () > 1);
+    const size_t K = classes.size ();
+    W.set_size (K, X.cols ());
+    b.assign (K, 0.0);
+    TaskPool::instance ().parallelFor ("one-vs-rest class", 0, K, 1, [&] (size_t k) {
+        DCDSolver s;
+        s.setPosC (Cp);
+        s.setNegC (Cn);
+        s.setEpsilon (eps);
+        s.setSampleWeights (weights);
+        s.train (X, LabelView (y, classes[k]), rows);
+        std::copy (s.getWeights ().begin (), s.getWeights ().end (), W.row (k));
+        b[k] = s.getBias ();
+    });
+}
+
+/// S(i, k) = x_i' w_k + b_k for all samples and classes in one blocked pass
+void OneVsRestSVM::scores (const FeatureMatrix &X, ScoreMatrix &S) const
+{
+    assert (X.cols () == W.cols ());
+    const size_t K = W.rows ();
+    const size_t d = W.cols ();
+    const size_t block = 64;
+    S.set_size (X.rows (), K);
+    TaskPool::instance ().parallelFor ("one-vs-rest scores", 0, (X.rows () + block - 1) / block, 0,
+                                       [&] (size_t blk) {
+        size_t ib = blk * block;
+        size_t ie = std::min (ib + block, X.rows ());
+        for (size_t k = 0; k < K; k++)
+        {
+            const double *w = W.row (k);
+            for (size_t i = ib; i < ie; i++)
+            {
+                const feature_t *x = X.row (i);
+                double f = b[k];
+                for (size_t j = 0; j < d; j++)
+                    f += w[j] * x[j];
+                S(i, k) = f;
+            }
+        }
+    });
+}
+
+/// Rewrite the models for raw features: column j of the matrix is feature
+/// f[j] normalized as (x - mu) * prec, see SVMTestSuite::foldedHyperplane
+void OneVsRestSVM::foldNormalization (const vecD &mu, const vecD &prec,
+                                      const vec<size_t> &f)
+{
+    assert (f.size () == W.cols ());
+    for (size_t k = 0; k < W.rows (); k++)
+        for (size_t j = 0; j < W.cols (); j++)
+        {
+            W(k, j) *= prec[f[j]];
+            b[k] -= W(k, j) * mu[f[j]];
+        }
+}
+
+void OneVsRestSVM::predict (const FeatureMatrix &X, vec<label_t> &p) const
+{
+    ScoreMatrix S;
+    scores (X, S);
+    p.resize (X.rows ());
+    for (size_t i = 0; i < X.rows (); i++)
+        p[i] = argmax (S.row (i));
+}
+
+label_t OneVsRestSVM::argmax (const double *s) const
+{
+    return classes[std::max_element (s, s + classes.size ()) - s];
+}
+
+/// Index of class 'l', numClasses () if 'l' is not one of the classes
+size_t OneVsRestSVM::classIndex (label_t l) const
+{
+    return std::find (classes.begin (), classes.end (), l) - classes.begin ();
+}
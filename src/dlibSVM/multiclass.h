@@ -0,0 +1,54 @@
+#ifndef MULTICLASS_H
+#define MULTICLASS_H
+
+#include <vector>
+#include <algorithm>
+#include "dcdsolver.h"
+
+/* One-vs-rest multi-class linear SVM
+ *
+ * One binary DCDSolver model is trained per class, concurrently, on the same
+ * normalized FeatureMatrix. Every model reads the shared label vector through
+ * a one-vs-rest LabelView, so neither the features nor the labels are copied
+ * per class. The K hyperplanes are stacked row-wise into a K x d weight
+ * matrix and prediction computes all K scores of a sample with one fused
+ * matrix product S = X W' + b.
+ *
+ * Usage:
+ * - setClasses with the sorted list of class labels, set the Cs and train.
+ * - scores fills an n x K matrix, predict returns the argmax class labels.
+*/
+class OneVsRestSVM
+{
+public:
+    OneVsRestSVM () : Cp(1.0), Cn(1.0), eps(0.1), weights(NULL) {}
+    void setClasses (const vec<label_t> &c) { classes = c; }
+    void setPosC (double C_) { Cp = C_; }
+    void setNegC (double C_) { Cn = C_; }
+    void setEpsilon (double e) { eps = e; }
+    void setSampleWeights (const vecD *sw) { weights = sw; }
+    void train (const FeatureMatrix &X, const vec<label_t> &y);
+    void train (const FeatureMatrix &X, const vec<label_t> &y,
+                const vec<size_t> &rows);
+    void scores (const FeatureMatrix &X, ScoreMatrix &S) const;
+    void predict (const FeatureMatrix &X, vec<label_t> &p) const;
+    label_t argmax (const double *s) const;
+    void foldNormalization (const vecD &mu, const vecD &prec, const vec<size_t> &f);
+
+    size_t numClasses () const { return classes.size (); }
+    size_t classIndex (label_t l) const;
+    const vec<label_t> & getClasses () const { return classes; }
+    const ScoreMatrix & getWeights () const { return W; }
+    const vecD & getBias () const { return b; }
+
+private:
+    vec<label_t> classes;
+    ScoreMatrix W;
+    vecD b;
+    double Cp;
+    double Cn;
+    double eps;
+    const vecD *weights;
+};
+
+#endif // MULTICLASS_H
@@ -0,0 +1,135 @@
+#include "quantilesketch.h"
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+/// Capacity of level 'h': k at the top level, 2/3 of the level above below it
+size_t QuantileSketch::capacity (size_t h) const
+{
+    double c = k * std::pow (2.0 / 3.0, (double) (levels.size () - 1 - h));
+    return std::max ((size_t) 2, (size_t) std::ceil (c));
+}
+
+size_t QuantileSketch::items () const
+{
+    size_t s = 0;
+    for (size_t h = 0; h < levels.size (); h++)
+        s += levels[h].size ();
+    return s;
+}
+
+void QuantileSketch::add (double x, uint64_t weight)
+{
+    if (weight == 0)
+        return;
+    for (size_t h = 0; (weight >> h) != 0; h++)
+        if ((weight >> h) & 1)
+        {
+            if (levels.size () <= h)
+                levels.resize (h + 1);
+            levels[h].push_back (x);
+            stored++;
+        }
+    n += weight;
+    if (stored >= budget)
+        compress ();
+}
+
+/// While the sketch holds more than the sum of the level capacities, compact
+/// the lowest level that is at or over its capacity
+void QuantileSketch::compress ()
+{
+    while (true)
+    {
+        budget = 0;
+        for (size_t h = 0; h < levels.size (); h++)
+            budget += capacity (h);
+        if (stored < budget)
+            return;
+        for (size_t h = 0; h < levels.size (); h++)
+        {
+            if (levels[h].size () < capacity (h))
+                continue;
+            if (h + 1 == levels.size ())
+                levels.resize (levels.size () + 1);
+            std::vector<double> &cur = levels[h];
+            std::sort (cur.begin (), cur.end ());
+            // An odd item out stays at this level
+            size_t m = cur.size () & ~(size_t) 1;
+            for (size_t i = flip ? 1 : 0; i < m; i += 2)
+                levels[h + 1].push_back (cur[i]);
+            flip = !flip;
+            cur.erase (cur.begin (), cur.begin () + m);
+            stored -= m / 2;
+            break;
+        }
+    }
+}
+
+void QuantileSketch::merge (const QuantileSketch &o)
+{
+    if (o.n == 0)
+        return;
+    if (levels.size () < o.levels.size ())
+        levels.resize (o.levels.size ());
+    for (size_t h = 0; h < o.levels.size (); h++)
+        levels[h].insert (levels[h].end (), o.levels[h].begin (), o.levels[h].end ());
+    n += o.n;
+    stored += o.stored;
+    compress ();
+}
+
+/// Smallest retained value whose weighted rank reaches q * n, q in [0, 1]
+double QuantileSketch::quantile (double q) const
+{
+    assert (n > 0);
+    std::vector<std::pair<double, uint64_t> > v;
+    v.reserve (items ());
+    uint64_t total = 0;
+    for (size_t h = 0; h < levels.size (); h++)
+        for (size_t i = 0; i < levels[h].size (); i++)
+        {
+            v.push_back (std::make_pair (levels[h][i], (uint64_t) 1 << h));
+            total += (uint64_t) 1 << h;
+        }
+    std::sort (v.begin (), v.end ());
+    double target = std::min (1.0, std::max (0.0, q)) * total;
+    uint64_t cum = 0;
+    for (size_t i = 0; i < v.size (); i++)
+    {
+        cum += v[i].second;
+        if (cum >= target)
+            return v[i].first;
+    }
+    return v.back ().first;
+}
+
+/// One line: k n flip levels, then size and items of every level
+void QuantileSketch::write (std::ostream &f) const
+{
+    f << k << " " << n << " " << flip << " " << levels.size ();
+    for (size_t h = 0; h < levels.size (); h++)
+    {
+        f << " " << levels[h].size ();
+        for (size_t i = 0; i < levels[h].size (); i++)
+            f << " " << levels[h][i];
+    }
+    f << "\n";
+}
+
+bool QuantileSketch::read (std::istream &f)
+{
+    size_t nl = 0, s = 0;
+    f >> k >> n >> flip >> nl;
+    levels.assign (nl, std::vector<double> ());
+    for (size_t h = 0; h < nl && f; h++)
+    {
+        f >> s;
+        levels[h].resize (s);
+        for (size_t i = 0; i < s; i++)
+            f >> levels[h][i];
+    }
+    stored = items ();
+    compress ();
+    return !f.fail ();
+}
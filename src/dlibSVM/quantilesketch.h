@@ -0,0 +1,56 @@
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+/* Mergeable streaming quantile sketch (KLL)
+ *
+ * Items are kept in a stack of compactors; an item at level h stands for
+ * 2^h input values. When the sketch outgrows its budget (the sum of the
+ * level capacities), the lowest level at its capacity is sorted and every
+ * other item (alternating between the odd and even ones) is promoted to the
+ * next level, the rest dropped. Level
+ * capacities shrink geometrically (factor 2/3) towards the bottom, so the
+ * sketch holds about 3k items whatever the stream length, and the rank error
+ * of a quantile is O(1/k) (k = 200: well below 1% of n).
+ *
+ * A value of integer weight w is added as one item at every level h whose
+ * bit is set in w, which is what w separate adds would compact to.
+ *
+ * Two sketches of disjoint streams merge by concatenating their levels and
+ * compacting, which is what makes parallel and incremental construction
+ * possible. Compaction is deterministic: the same input in the same order
+ * gives the same sketch.
+ *
+ * Usage:
+ *      QuantileSketch s;
+ *      for (...) s.add (x);
+ *      double median = s.quantile (0.5);
+*/
+class QuantileSketch
+{
+public:
+    QuantileSketch (unsigned int k_ = 200) : k(k_), n(0), flip(false), stored(0), budget(0) {}
+    void add (double x, uint64_t weight = 1);
+    void merge (const QuantileSketch &o);
+    double quantile (double q) const;
+    uint64_t count () const { return n; }
+    size_t items () const;
+    void write (std::ostream &f) const;
+    bool read (std::istream &f);
+
+private:
+    size_t capacity (size_t h) const;
+    void compress ();
+
+    unsigned int k;
+    uint64_t n;
+    bool flip;
+    size_t stored;
+    size_t budget;
+    std::vector<std::vector<double> > levels;
+};
+
+#endif // QUANTILESKETCH_H
@@ -0,0 +1,147 @@
+#include "quantize.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define QUANTIZE_X86
+#endif
+
+typedef int32_t (*dot_t) (const int8_t *x, const int8_t *w, size_t n);
+
+static int32_t dotPortable (const int8_t *x, const int8_t *w, size_t n)
+{
+    int32_t s = 0;
+    for (size_t i = 0; i < n; i++)
+        s += (int32_t) x[i] * w[i];
+    return s;
+}
+
+#ifdef QUANTIZE_X86
+__attribute__((target("avx2")))
+static inline int32_t hsum (__m256i acc)
+{
+    __m128i s = _mm_add_epi32 (_mm256_castsi256_si128 (acc),
+                               _mm256_extracti128_si256 (acc, 1));
+    s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0x4E));
+    s = _mm_add_epi32 (s, _mm_shuffle_epi32 (s, 0xB1));
+    return _mm_cvtsi128_si32 (s);
+}
+
+/// 32 products per step: |x| * sign (w, x) in int16 pairs, widened to int32
+__attribute__((target("avx2")))
+static int32_t dotAvx2 (const int8_t *x, const int8_t *w, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi16 (1);
+    __m256i acc = _mm256_setzero_si256 ();
+    for (size_t i = 0; i < n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) (x + i));
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (w + i));
+        __m256i p = _mm256_maddubs_epi16 (_mm256_sign_epi8 (a, a),
+                                          _mm256_sign_epi8 (b, a));
+        acc = _mm256_add_epi32 (acc, _mm256_madd_epi16 (p, ones));
+    }
+    return hsum (acc);
+}
+
+/// Same as dotAvx2 with the multiply and both additions fused in vpdpbusd
+__attribute__((target("avx2,avx512vnni,avx512vl")))
+static int32_t dotVnni (const int8_t *x, const int8_t *w, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256 ();
+    for (size_t i = 0; i < n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) (x + i));
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (w + i));
+        acc = _mm256_dpbusd_epi32 (acc, _mm256_sign_epi8 (a, a),
+                                   _mm256_sign_epi8 (b, a));
+    }
+    return hsum (acc);
+}
+#endif
+
+static const char *dotName = "portable";
+
+static dot_t selectDot ()
+{
+#ifdef QUANTIZE_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512vnni") && __builtin_cpu_supports ("avx512vl"))
+    {
+        dotName = "avx512-vnni";
+        return dotVnni;
+    }
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        dotName = "avx2";
+        return dotAvx2;
+    }
+#endif
+    return dotPortable;
+}
+
+static const dot_t dot = selectDot ();
+
+const char * QuantizedScorer::kernelName ()
+{
+    return dotName;
+}
+
+/// Per-feature steps from the range of the (normalized) training set and the
+/// int8 weights with their global scale
+void QuantizedScorer::build (const vecD_t &w, double bias_, const vecS_t &train,
+                             const vec<size_t> &f)
+{
+    assert (w.size () == f.size () && train.size () > 0);
+    d = f.size ();
+    dpad = (d + 31) / 32 * 32;
+    bias = bias_;
+    vecD_t range (d, 0.0);
+    for (size_t i = 0; i < train.size (); i++)
+        for (size_t j = 0; j < d; j++)
+            range[j] = std::max (range[j], (double) std::fabs (train[i][f[j]]));
+    step.resize (d);
+    scale = 0;
+    for (size_t j = 0; j < d; j++)
+    {
+        double r = std::min (clip, range[j]);
+        step[j] = ((r > 0) ? r : 1.0) / 127.0;
+        scale = std::max (scale, std::fabs (w[j]) * step[j] / 127.0);
+    }
+    if (scale == 0)
+        scale = 1;
+    wq.assign (dpad, 0);
+    for (size_t j = 0; j < d; j++)
+        wq[j] = (int8_t) std::lround (w[j] * step[j] / scale);
+}
+
+void QuantizedScorer::quantize (const vecS_t &x, const vec<size_t> &f)
+{
+    assert (f.size () == d);
+    n = x.size ();
+    xq.assign (n * dpad, 0);
+    vecD_t offset (d, 0.0), mult (d);
+    for (size_t j = 0; j < d; j++)
+    {
+        mult[j] = 1.0 / step[j];
+        if (mu.size () > 0)
+        {
+            offset[j] = mu[f[j]];
+            mult[j] *= prec[f[j]];
+        }
+    }
+    TaskPool::instance ().parallelFor ("quantize", 0, n, 0, [&] (size_t i) {
+        int8_t *q = &xq[i * dpad];
+        for (size_t j = 0; j < d; j++)
+        {
+            long v = std::lround ((x[i][f[j]] - offset[j]) * mult[j]);
+            q[j] = (int8_t) std::max (-127L, std::min (127L, v));
+        }
+    });
+}
+
+void QuantizedScorer::scores (vecD_t &s) const
+{
+    s.resize (n);
+    TaskPool::instance ().parallelFor ("int8 scores", 0, n, 0, [&] (size_t i) {
+        s[i] = bias + scale * dot (&xq[i * dpad], &wq[0], dpad);
+    });
+}
@@ -0,0 +1,64 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <vector>
+#include <cstdint>
+#include "datahandler.h"
+
+/* Int8 scoring of a trained linear model f(z) = w' z + bias
+ *
+ * The samples are normalized with trainMean / trainPrec, so every feature is
+ * in units of its training standard deviation. Feature j is clipped to
+ * +-r_j, r_j = min (clip, max |z_j| over the training set), and stored as
+ * int8 with step s_j = r_j / 127; in raw units the step is s_j / prec_j. The
+ * weights absorb the per-feature steps, w_j s_j = S wq_j with one global
+ * scale S, so that
+ *
+ *      f(z) ~= bias + S * sum_j wq_j q_j
+ *
+ * is a single int8 x int8 dot product accumulated in int32. Rows are padded
+ * with zeros to a multiple of 32 bytes.
+ *
+ * The dot product uses AVX512-VNNI (vpdpbusd) or AVX2 (vpmaddubsw) when the
+ * CPU supports them, selected at run time, and a portable loop otherwise.
+ * Both SIMD kernels compute |q| * sign (wq, q) so the unsigned x signed
+ * instructions never saturate for values in [-127, 127].
+ *
+ * With setInputNormalization the samples given to quantize are raw and the
+ * normalization is folded into the per-feature quantization multipliers.
+ *
+ * Usage:
+ *      QuantizedScorer qs;
+ *      qs.build (w, bias, trainSet, featureSet);
+ *      qs.quantize (testSet, featureSet);
+ *      qs.scores (scores);
+*/
+class QuantizedScorer
+{
+public:
+    QuantizedScorer () : d(0), dpad(0), n(0), clip(4.0), scale(0), bias(0) {}
+    void setClip (double c) { clip = c; }
+    void setInputNormalization (const vecD_t &mu_, const vecD_t &prec_)
+    { mu = mu_; prec = prec_; }
+    void build (const vecD_t &w, double bias_, const vecS_t &train,
+                const vec<size_t> &f);
+    void quantize (const vecS_t &x, const vec<size_t> &f);
+    void scores (vecD_t &s) const;
+    size_t bytes () const { return xq.size (); }
+    static const char * kernelName ();
+
+private:
+    size_t d;
+    size_t dpad;
+    size_t n;
+    double clip;
+    double scale;
+    double bias;
+    vecD_t step;
+    vecD_t mu;
+    vecD_t prec;
+    vec<int8_t> wq;
+    vec<int8_t> xq;
+};
+
+#endif // QUANTIZE_H
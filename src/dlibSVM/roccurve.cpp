@@ -0,0 +1,93 @@
+#include "roccurve.h"
+
+void RocCurve::compute (const vecD_t &scores, const vec<label_t> &labels,
+                        const vecD_t *weights)
+{
+    assert (scores.size () == labels.size ());
+    vec<size_t> order;
+    npos = nneg = 0;
+    for (size_t i = 0; i < scores.size (); i++)
+    {
+        if (labels[i] == 0)
+            continue;
+        order.push_back (i);
+        ((labels[i] > 0) ? npos : nneg) += (weights != NULL) ? (*weights)[i] : 1.0;
+    }
+    std::sort (order.begin (), order.end (),
+               [&] (size_t a, size_t b) { return scores[a] > scores[b]; });
+
+    curve.clear ();
+    double tp = 0, fp = 0;
+    for (size_t k = 0; k < order.size (); )
+    {
+        double s = scores[order[k]];
+        for (; k < order.size () && scores[order[k]] == s; k++)
+            ((labels[order[k]] > 0) ? tp : fp) += (weights != NULL) ? (*weights)[order[k]] : 1.0;
+        RocPoint p;
+        p.threshold = (k < order.size ()) ? 0.5 * (s + scores[order[k]]) : s - 1.0;
+        p.tp = tp;
+        p.fp = fp;
+        p.tpr = (npos > 0) ? tp / npos : 0;
+        p.fpr = (nneg > 0) ? fp / nneg : 0;
+        p.precision = tp / (tp + fp);
+        curve.push_back (p);
+    }
+}
+
+double RocCurve::rocAuc () const
+{
+    double auc = 0, x = 0, y = 0;
+    for (size_t k = 0; k < curve.size (); k++)
+    {
+        auc += (curve[k].fpr - x) * (curve[k].tpr + y) / 2;
+        x = curve[k].fpr;
+        y = curve[k].tpr;
+    }
+    return auc;
+}
+
+double RocCurve::prAuc () const
+{
+    double ap = 0, r = 0;
+    for (size_t k = 0; k < curve.size (); k++)
+    {
+        ap += (curve[k].tpr - r) * curve[k].precision;
+        r = curve[k].tpr;
+    }
+    return ap;
+}
+
+/// Lowest threshold (largest recall) with precision >= target, the highest
+/// threshold of the curve if the target cannot be reached
+double RocCurve::thresholdForPrecision (double target) const
+{
+    assert (curve.size () > 0);
+    double t = curve[0].threshold;
+    for (size_t k = 0; k < curve.size (); k++)
+        if (curve[k].precision >= target)
+            t = curve[k].threshold;
+    return t;
+}
+
+/// Highest threshold (largest precision) with recall >= target
+double RocCurve::thresholdForRecall (double target) const
+{
+    assert (curve.size () > 0);
+    for (size_t k = 0; k < curve.size (); k++)
+        if (curve[k].tpr >= target)
+            return curve[k].threshold;
+    return curve.back ().threshold;
+}
+
+/// Print at most 'maxRows' points of the curve, evenly spread over it
+void RocCurve::print (std::ostream &o, size_t maxRows) const
+{
+    o << std::fixed << std::setprecision (4)
+      << std::setw(12) << "threshold" << std::setw(8) << "TP" << std::setw(8) << "FP"
+      << std::setw(10) << "TPR" << std::setw(10) << "FPR" << std::setw(10) << "prec" << "\n";
+    size_t step = std::max ((size_t) 1, curve.size () / std::max ((size_t) 1, maxRows));
+    for (size_t k = 0; k < curve.size (); k += step)
+        o << std::setw(12) << curve[k].threshold << std::setw(8) << (size_t) curve[k].tp
+          << std::setw(8) << (size_t) curve[k].fp << std::setw(10) << curve[k].tpr
+          << std::setw(10) << curve[k].fpr << std::setw(10) << curve[k].precision << "\n";
+}
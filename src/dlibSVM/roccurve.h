@@ -0,0 +1,56 @@
+#ifndef ROCCURVE_H
+#define ROCCURVE_H
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include "datahandler.h"
+
+typedef vec<double> vecD_t;
+
+/// One operating point: samples with score >= threshold are predicted +1
+struct RocPoint
+{
+    double threshold;
+    double tp;
+    double fp;
+    double tpr;         // = recall
+    double fpr;
+    double precision;
+};
+
+/* All-threshold evaluation of a binary classifier from its scores
+ *
+ * The scores are sorted once and swept from the highest to the lowest, which
+ * gives the confusion counts at every distinct threshold in O(n log n).
+ * Samples with equal scores are one step of the curve. From the curve:
+ * - ROC AUC (trapezoidal rule over FPR / TPR)
+ * - PR AUC (average precision)
+ * - the threshold reaching a target precision (largest recall) or a target
+ *   recall (largest precision)
+ * Thresholds lie half way between consecutive distinct scores, so it does
+ * not matter whether a classifier compares with > or >=.
+ * Labels > 0 are positive, < 0 negative and 0 (unlabelled) are skipped.
+ * Optional sample weights count a sample as that many identical ones.
+*/
+class RocCurve
+{
+public:
+    RocCurve () : npos(0), nneg(0) {}
+    void compute (const vecD_t &scores, const vec<label_t> &labels,
+                  const vecD_t *weights = NULL);
+    double rocAuc () const;
+    double prAuc () const;
+    double thresholdForPrecision (double target) const;
+    double thresholdForRecall (double target) const;
+    const vec<RocPoint> & points () const { return curve; }
+    void print (std::ostream &o, size_t maxRows) const;
+
+private:
+    vec<RocPoint> curve;
+    double npos;
+    double nneg;
+};
+
+#endif // ROCCURVE_H
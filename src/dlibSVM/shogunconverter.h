@@ -0,0 +1,60 @@
+#ifndef SHOGUNCONVERTER_H
+#define SHOGUNCONVERTER_H
+
+#include <shogun/features/DenseFeatures.h>
+#include <shogun/features/DenseSubsetFeatures.h>
+#include <shogun/labels/BinaryLabels.h>
+#include "dataconverter.h"
+
+/* Shogun views of the DataHandler data sets, nothing is copied
+ *
+ * A FeatureMatrix stores one sample per row, contiguously, which is exactly
+ * the layout of a column-major Shogun SGMatrix with one sample per column:
+ * rowMajorToShogun (m) is an m.cols () x m.rows () SGMatrix over m.data.
+ * It is created with ref counting disabled, so neither the SGMatrix nor the
+ * CDenseFeatures holding it ever frees the buffer; 'm' keeps ownership and
+ * must outlive every Shogun object built on it (SG_UNREF them first).
+ *
+ * Feature subsets are CDenseSubsetFeatures over the full features, which map
+ * the dimension indices on every dot product instead of copying; subsets of
+ * samples are features->add_subset (rows), also without copying.
+ *
+ * Usage:
+ *      FeatureMatrix m;
+ *      dataHandlerToRowMajor (dh.getTrainSetConst (), allFeatures, m);
+ *      CDenseFeatures<feature_t> *features = rowMajorToShogunFeatures (m);
+ *      CDenseSubsetFeatures<feature_t> *sub = shogunFeatureSubset (features, f);
+ *      ...
+ *      SG_UNREF (sub);
+*/
+inline shogun::SGMatrix<feature_t> rowMajorToShogun (FeatureMatrix &m)
+{
+    return shogun::SGMatrix<feature_t> (m.data.data (), (shogun::index_t) m.cols (),
+                                        (shogun::index_t) m.rows (), false);
+}
+
+inline shogun::CDenseFeatures<feature_t> * rowMajorToShogunFeatures (FeatureMatrix &m)
+{
+    return new shogun::CDenseFeatures<feature_t> (rowMajorToShogun (m));
+}
+
+/// Dimensions 'f' of 'features'; holds a reference to 'features'
+inline shogun::CDenseSubsetFeatures<feature_t> *
+shogunFeatureSubset (shogun::CDenseFeatures<feature_t> *features, const vec<size_t> &f)
+{
+    shogun::SGVector<int32_t> idx ((shogun::index_t) f.size ());
+    for (size_t j = 0; j < f.size (); j++)
+        idx[j] = (int32_t) f[j];
+    return new shogun::CDenseSubsetFeatures<feature_t> (features, idx);
+}
+
+/// Labels > 0 as +1, the rest as -1 (copied, one double per sample)
+inline shogun::CBinaryLabels * dataHandlerLabelsToShogun (const vec<sample_t> &h)
+{
+    shogun::CBinaryLabels *labels = new shogun::CBinaryLabels ((int32_t) h.size ());
+    for (size_t i = 0; i < h.size (); i++)
+        labels->set_label ((int32_t) i, h[i].getLabel () > 0 ? +1 : -1);
+    return labels;
+}
+
+#endif // SHOGUNCONVERTER_H
@@ -14,6 +14,9 @@ int main(int argc, char ** argv)
     std::string test_file;
     double train_ratio;
     double C1 = 1.0, C2 = 1.0;
+    // Training worker started by DistributedSVM
+    if (argc == 3 && std::string(argv[1]) == "--worker")
+        return DistributedSVM::workerMain (std::stoi (std::string(argv[2])));
     if (argc < 5)
     {
         printHelp ();
@@ -22,7 +25,18 @@ int main(int argc, char ** argv)
     if (argc >= 5)
     {
         csv_file = std::string(argv[1]);
-        if (std::string(argv[2]) == "0")
+        if (std::string(argv[2]) == "2")
+        {
+            train_file = std::string(argv[3]);
+            std::cout << "Incrementally training on new samples of: " << train_file
+                      << " with state file " << argv[4] << ".\n\n";
+            if (!svm.loadIncremental (train_file, std::string(argv[4])))
+            {
+                std::cout << "No new labelled samples.\n";
+                return 0;
+            }
+        }
+        else if (std::string(argv[2]) == "0")
         {
             train_file = std::string(argv[3]);
             test_file = std::string(argv[4]);
@@ -55,6 +69,8 @@ int main(int argc, char ** argv)
 
     std::ifstream tests (csv_file.c_str ());
     std::string line, word;
+    std::vector<std::vector<size_t> > subsets;
+    std::vector<std::string> predFiles;
 
     svm.setPosC (C1);
     svm.setNegC (C2);
@@ -62,25 +78,52 @@ int main(int argc, char ** argv)
     {
         std::string predFile = line.substr (line.find_last_of (',')+1);
         if (predFile != "")
-        {
             predFile = predFile.substr (predFile.find_first_not_of (' '));
-            svm.predictionFile (predFile);
-        }
-        else
-            svm.noOutput ();
         std::stringstream ss (line.substr (0, line.find_last_of (',')));
         std::vector<size_t> ff;
-        std::cout << "###################################################\n"
-                  <<"Testing with features: ";
         while (std::getline (ss, word, ','))
         {
-            std::cout << (size_t) std::stoul (word) << ", ";
-            ff.push_back ((size_t) std::stoul (word) - 1);
+            std::string token;
+            std::stringstream (word) >> token;
+            if (token == "all")
+                for (size_t i = 0; i < svm.featureCount (); i++)
+                    ff.push_back (i);
+            else
+                ff.push_back ((size_t) std::stoul (word) - 1);
         }
+        subsets.push_back (ff);
+        predFiles.push_back (predFile);
+    }
+
+    std::vector<size_t> cases;
+    if (svm.screenTop () > 0)
+        cases = svm.screenSubsets (subsets);
+    else
+        for (size_t i = 0; i < subsets.size (); i++)
+            cases.push_back (i);
+
+    // Test cases run in order (the C found for one is the start of the
+    // next), each runs its cross validation folds and scoring on the pool
+    for (size_t c = 0; c < cases.size (); c++)
+    {
+        const std::vector<size_t> &ff = subsets[cases[c]];
+        if (predFiles[cases[c]] != "")
+            svm.predictionFile (predFiles[cases[c]]);
+        else
+            svm.noOutput ();
+        std::cout << "###################################################\n"
+                  <<"Testing with features: ";
+        // Hashed columns ('all') are too many to list
+        for (size_t i = 0; i < std::min (ff.size (), (size_t) 64); i++)
+            std::cout << ff[i] + 1 << ", ";
+        if (ff.size () > 64)
+            std::cout << "... (" << ff.size () << " features)";
         std::cout << "\n";
         svm.setTestMode (CUSTOM, ff);
         svm.classify ();
     }
+    svm.saveState ();
+    TaskPool::instance ().printStats ();
     return 0;
 }
 
@@ -93,20 +136,30 @@ void printHelp ()
     printf ("- file_specify_tests:\n"
             "\t\t\tLook at test.csv.sample. Each line represents a test case\n"
             "\t\t\twhich specifies the output file name and comma separated\n"
-            "\t\t\tlist of features to be selected for training and testing.\n");
+            "\t\t\tlist of features to be selected for training and testing.\n"
+            "\t\t\t'all' in the list selects every feature (e.g. all hashed\n"
+            "\t\t\tcolumns).\n");
     printf ("- mode:\n"
             "\t\t\t0 to specify training_file_name and test_file_name as 3rd\n"
             "\t\t\tand 4th arguments resp.\n"
             "\t\t\t1 to specify features_file_name and\n"
             "\t\t\tnum_of_training_samples_or_train_to_test_ratio as 3rd and\n"
-            "\t\t\t4th arguments resp.\n");
+            "\t\t\t4th arguments resp.\n"
+            "\t\t\t2 to incrementally train on the samples appended to\n"
+            "\t\t\tfeatures_file since the last run. The 4th argument is the\n"
+            "\t\t\tstate file that is read and updated ([incremental]\n"
+            "\t\t\tDriftTolerance in config/ranking.ini sets when C is\n"
+            "\t\t\tsearched again).\n");
     printf ("- features_file:\n"
             "\t\t\tDepending on the 'mode' value this can be the training file\n"
             "\t\t\tname or the feature file name. In first case, the entire\n"
             "\t\t\tfile is used for training while in the second case, the\n"
             "\t\t\t4th argument specifies the number of samples to use as\n"
             "\t\t\ttraining samples. The rest of the samples in\n"
-            "\t\t\tfeatures_file are used for testing.\n");
+            "\t\t\tfeatures_file are used for testing.\n"
+            "\t\t\tAny file name may be a comma separated list of files\n"
+            "\t\t\tand glob patterns ('shards_*.txt.gz'), the shards are\n"
+            "\t\t\tread concurrently and merged.\n");
     printf ("- num_of_training_samples_or_train_to_test_ratio:\n"
             "\t\t\tEither the testing file or the number of samples to use\n"
             "\t\t\tout of feature_file for train/test split. This could be\n"
@@ -117,8 +170,95 @@ void printHelp ()
     printf ("- weight_of_class_-1: \t [optional]\n"
             "\t\t\tValue of C for class 2 (negative class) for\n"
             "\t\t\tlinear SVM training.\n");
+    printf ("- config/ranking.ini: \t [optional keys]\n"
+            "\t\t\t[svm] Solver = dlib | dcd selects the dlib cutting plane\n"
+            "\t\t\ttrainer (default) or the dual coordinate descent solver.\n"
+            "\t\t\t[svm] Benchmark = true compares both solvers for\n"
+            "\t\t\ttime-to-accuracy after every test case.\n"
+            "\t\t\t[svm] Search = grid | halving | adaptive picks how C is\n"
+            "\t\t\tsearched when a weight of 0 is given: the coarse + fine\n"
+            "\t\t\tgrid, successive halving over (C1, C2) pairs (HalvingEta\n"
+            "\t\t\t> 1, HalvingMinFraction) or golden section / pattern search\n"
+            "\t\t\t(PerClassC, AdaptiveTolerance, AdaptiveMaxEvals).\n"
+            "\t\t\t[svm] TargetPrecision or TargetRecall picks the decision\n"
+            "\t\t\tthreshold from the cross validation scores, [svm]\n"
+            "\t\t\tThreshold sets it directly (default 0).\n"
+            "\t\t\t[svm] Screen = N ranks all test cases by a fast cross\n"
+            "\t\t\tvalidated ridge / LDA fit on cached Gram matrices\n"
+            "\t\t\t(ScreenLambda, default 1) and only trains the SVM on\n"
+            "\t\t\tthe N best feature subsets.\n"
+            "\t\t\t[svm] FixedDimension = false disables the dlib path\n"
+            "\t\t\twith compile time sample dimension (8, 16, 32 or 64)\n"
+            "\t\t\tused for subsets of up to 64 features.\n"
+            "\t\t\t[svm] Quantize = true scores the test set with int8\n"
+            "\t\t\tfeatures and weights (QuantizeClip, default 4 standard\n"
+            "\t\t\tdeviations) and reports the deviation from the double\n"
+            "\t\t\tprecision scores.\n"
+            "\t\t\t[svm] Deduplicate = true collapses identical rows into\n"
+            "\t\t\tweighted samples before the train / test split, so no\n"
+            "\t\t\tcopy of a training row is tested; binary models use the\n"
+            "\t\t\tdcd solver, which weights every sample.\n"
+            "\t\t\t[svm] Mining = true keeps the rows class balancing\n"
+            "\t\t\tleaves out in a pool and adds its margin violators to\n"
+            "\t\t\tthe training set, retraining with warm start until none\n"
+            "\t\t\tare left (at most MiningRounds, default 10; not with\n"
+            "\t\t\t[data] Reservoir).\n"
+            "\t\t\t[svm] CacheDir = dir keeps cross validation results\n"
+            "\t\t\t(with the accuracy of every fold) and trained models\n"
+            "\t\t\tin 'dir', keyed by a hash of the data and the\n"
+            "\t\t\tparameters, to reuse them in later runs.\n"
+            "\t\t\t[data] Scaling = robust normalizes with the median and\n"
+            "\t\t\tIQR of streaming quantile sketches instead of the mean\n"
+            "\t\t\tand standard deviation; [data] Clip = c clips normalized\n"
+            "\t\t\tfeatures to +-c. Incremental states keep the sketches.\n"
+            "\t\t\t[parallel] Threads = n sizes the task pool shared by\n"
+            "\t\t\tall parallel stages, e.g. the cross validation folds\n"
+            "\t\t\t(default: one per CPU), Affinity = true pins its worker\n"
+            "\t\t\tthreads to CPUs, Stats = true prints the\n"
+            "\t\t\ttime and queue statistics per task at the end.\n"
+            "\t\t\t[svm] RawInput = true leaves the test set unnormalized\n"
+            "\t\t\tand scores it with the normalization folded into the\n"
+            "\t\t\tweights (not with [data] Clip, Benchmark or mode 2).\n"
+            "\t\t\t[svm] Cascade = true scores features in order of impact\n"
+            "\t\t\tin blocks of CascadeBlock (default 4) and stops once the\n"
+            "\t\t\trest cannot change the decision (not with Quantize);\n"
+            "\t\t\tthe log then holds decisions, not scores, and no\n"
+            "\t\t\tROC / PR AUC.\n"
+            "\t\t\t[data] Reservoir = true (mode 1 with a number of\n"
+            "\t\t\ttraining samples) streams the file once and keeps a\n"
+            "\t\t\tuniform sample of that many rows per class; with\n"
+            "\t\t\tStreamTest = true the other rows are scored in batches\n"
+            "\t\t\tof StreamBatch (default 65536) instead of being stored\n"
+            "\t\t\t(only a score and a label per row are kept, for the\n"
+            "\t\t\tROC curve).\n"
+            "\t\t\t[distributed] Workers = n (mode 0) trains on the shards\n"
+            "\t\t\tof the training file in n worker processes that only\n"
+            "\t\t\texchange statistics and weights over Unix sockets,\n"
+            "\t\t\tMethod = admm (exact, default) | mixing (averaging),\n"
+            "\t\t\tRho (10), MaxIterations (200), Tolerance (0.001); C is\n"
+            "\t\t\tnot searched.\n"
+            "\t\t\t[data] HashBits = b hashes the index of every\n"
+            "\t\t\tindex:value pair (HashSeed, default 0) into one of 2^b\n"
+            "\t\t\tcolumns with a random sign, for sparse indices in the\n"
+            "\t\t\tmillions or named features; test cases then select\n"
+            "\t\t\tcolumns 1..2^b ('all'). Rows are dense, so b is at\n"
+            "\t\t\tmost 16, unless [data] SparseRows = true keeps their\n"
+            "\t\t\tnon-zeros only (b at most 22): binary models then train\n"
+            "\t\t\twith the dcd solver, features are scaled but not\n"
+            "\t\t\tcentered and options needing dense rows are turned\n"
+            "\t\t\toff. HashSeed takes any 64 bit value (0x.. for hex).\n"
+            "\t\t\tIncremental states (dense rows) keep bits and seed.\n"
+            "\t\t\t[svm] Sparse = true trains an L1 (SparseL1Ratio = 1) or\n"
+            "\t\t\telastic net (< 1) regularized linear model along a path\n"
+            "\t\t\tof SparsePathLength (20) lambdas down to SparsePathRatio\n"
+            "\t\t\t(0.01) of the largest, keeps the sparsest one within\n"
+            "\t\t\tSparseTolerance (0.01) of the best cross validation\n"
+            "\t\t\taccuracy and prints the features it does not use (the\n"
+            "\t\t\tweights of 1 and -1 weight the classes). Binary labels\n"
+            "\t\t\tonly, not with [distributed] Workers or mode 2.\n");
     printf ("Example usage:\n");
     std::cout << "./bin/dynamicRanking/svm config/tests.csv.sample 1 config/features_05_01.txt.sample 400\n";
     std::cout << "./bin/dynamicRanking/svm config/tests.csv.sample 1 config/features_05_01.txt.sample 0.6 1.1 1\n";
     std::cout << "./bin/dynamicRanking/svm config/tests.csv.sample 0 config/features_05_01.txt.sample config/features_05_01.txt.sample\n";
+    std::cout << "./bin/dynamicRanking/svm config/tests.csv.sample 2 config/features_05_01.txt.sample config/features.state\n";
 }
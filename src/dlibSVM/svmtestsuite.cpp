@@ -5,7 +5,24 @@ SVMTestSuite::SVMTestSuite() :
     C1(0),
     C2(0),
     writePred(false),
-    separateTrainTestDat(false)
+    separateTrainTestDat(false),
+    solver(DLIB_CUTTING_PLANE),
+    search(GRID_SEARCH),
+    priorC1(0),
+    priorC2(0),
+    threshold(0),
+    configThreshold(0),
+    targetPrecision(0),
+    targetRecall(0),
+    screenN(0),
+    screenLambda(1.0),
+    benchmark(false),
+    multiClass(false),
+    incremental(false),
+    fixedDim(true),
+    quantized(false),
+    sparseChosen(0),
+    quantizeClip(4.0)
 {}
 
 SVMTestSuite::SVMTestSuite(const Str_t &train_file, const Str_t &test_file) :
@@ -13,7 +30,19 @@ SVMTestSuite::SVMTestSuite(const Str_t &train_file, const Str_t &test_file) :
     C1(0),
     C2(0),
     writePred(false),
-    separateTrainTestDat(false)
+    separateTrainTestDat(false),
+    solver(DLIB_CUTTING_PLANE),
+    search(GRID_SEARCH),
+    priorC1(0),
+    priorC2(0),
+    threshold(0),
+    configThreshold(0),
+    targetPrecision(0),
+    targetRecall(0),
+    benchmark(false),
+    multiClass(false),
+    incremental(false),
+    sparseChosen(0)
 {
     load (train_file, test_file);
 }
@@ -23,7 +52,19 @@ SVMTestSuite::SVMTestSuite(const Str_t &feature_file, uint num_train_samp) :
     C1(0),
     C2(0),
     writePred(false),
-    separateTrainTestDat(false)
+    separateTrainTestDat(false),
+    solver(DLIB_CUTTING_PLANE),
+    search(GRID_SEARCH),
+    priorC1(0),
+    priorC2(0),
+    threshold(0),
+    configThreshold(0),
+    targetPrecision(0),
+    targetRecall(0),
+    benchmark(false),
+    multiClass(false),
+    incremental(false),
+    sparseChosen(0)
 {
     load (feature_file, num_train_samp);
 }
@@ -33,7 +74,19 @@ SVMTestSuite::SVMTestSuite(const Str_t &feature_file, double train_ratio) :
     C1(0),
     C2(0),
     writePred(false),
-    separateTrainTestDat(false)
+    separateTrainTestDat(false),
+    solver(DLIB_CUTTING_PLANE),
+    search(GRID_SEARCH),
+    priorC1(0),
+    priorC2(0),
+    threshold(0),
+    configThreshold(0),
+    targetPrecision(0),
+    targetRecall(0),
+    benchmark(false),
+    multiClass(false),
+    incremental(false),
+    sparseChosen(0)
 {
     load (feature_file, train_ratio);
 }
@@ -42,15 +95,32 @@ void SVMTestSuite::load (const Str_t &train_file, const Str_t &test_file)
 {
     trainName = train_file;
     testName = test_file;
-    DataHandler trainDat (train_file, 1.0);
-    trainSet = trainDat.getTrainSetConst ();
-    trainMean = trainDat.getTrainMeanConst ();
-    trainPrec = trainDat.getTrainPrecConst ();
-    numFeat = trainDat.num_feat;
-    assert (trainSet.size () > 0 &&
-            trainMean.size () == trainDat.num_feat &&
-            trainPrec.size () == trainDat.num_feat);
-    DataHandler testDat (test_file, trainMean, trainPrec);
+    readConfig ();
+    // Parse the test data while the training data is read and normalized,
+    // it is normalized with the training statistics once those are known
+    vecS_t rawTest;
+    TaskGroup testReader;
+    TaskPool::instance ().spawn (testReader, "read test", [&] {
+        DataHandler::readSamples (test_file, rawTest);
+    });
+    if (distWorkers > 0)
+        startWorkers (train_file);
+    else
+    {
+        DataHandler trainDat (train_file, 1.0, mining);
+        trainSet = trainDat.getTrainSetConst ();
+        poolSet = trainDat.getPoolSetConst ();
+        trainMean = trainDat.getTrainMeanConst ();
+        trainPrec = trainDat.getTrainPrecConst ();
+        numFeat = trainDat.num_feat;
+        classes = trainDat.getClasses ();
+        multiClass = trainDat.isMultiClass ();
+        assert (trainSet.size () > 0 &&
+                trainMean.size () == trainDat.num_feat &&
+                trainPrec.size () == trainDat.num_feat);
+    }
+    TaskPool::instance ().wait (testReader);
+    DataHandler testDat (rawTest, trainMean, trainPrec);
     testSet = testDat.getTestSetConst ();
     assert (testSet.size () > 0);
     initTrainer ();
@@ -60,38 +130,323 @@ void SVMTestSuite::load (const Str_t &feature_file, uint num_train_samp)
 {
     featureName = feature_file;
     assert (num_train_samp > 0);
-    DataHandler featureDat(feature_file, num_train_samp);
+    readConfig ();
+    DataHandler featureDat(feature_file, num_train_samp, mining, reservoir);
     trainSet = featureDat.getTrainSetConst ();
-    testSet = featureDat.getTestSetConst ();
+    poolSet = featureDat.getPoolSetConst ();
+    if (!reservoir)
+        testSet = featureDat.getTestSetConst ();
+    sampledRows = featureDat.getSampledRowsConst ();
     trainMean = featureDat.getTrainMeanConst ();
     trainPrec = featureDat.getTrainPrecConst ();
     trainRatio = featureDat.trainTestRatio;
     numFeat = featureDat.num_feat;
+    classes = featureDat.getClasses ();
+    multiClass = featureDat.isMultiClass ();
     assert (trainSet.size () > 0 &&
             trainMean.size () == featureDat.num_feat &&
             trainPrec.size () == featureDat.num_feat);
+    if (reservoir)
+    {
+        // Multi-class scoring and the benchmark need the whole test set
+        streamTest = streamTest && !multiClass && !benchmark;
+        if (!streamTest)
+            materializeTestSet ();
+    }
     initTrainer ();
 }
 
 void SVMTestSuite::load (const Str_t &feature_file, double train_ratio)
 {
     assert (train_ratio > 0);
-    DataHandler featureDat(feature_file, train_ratio);
+    readConfig ();
+    DataHandler featureDat(feature_file, train_ratio, mining);
     trainSet = featureDat.getTrainSetConst ();
+    poolSet = featureDat.getPoolSetConst ();
     testSet = featureDat.getTestSetConst ();
     trainMean = featureDat.getTrainMeanConst ();
     trainPrec = featureDat.getTrainPrecConst ();
     trainRatio = featureDat.trainTestRatio;
     numFeat = featureDat.num_feat;
+    classes = featureDat.getClasses ();
+    multiClass = featureDat.isMultiClass ();
     assert (trainSet.size () > 0 &&
             trainMean.size () == featureDat.num_feat &&
             trainPrec.size () == featureDat.num_feat);
     initTrainer ();
 }
 
-void SVMTestSuite::initTrainer ()
+/* Data parallel training ([distributed] Workers): the training shards are
+ * read by worker processes (see DistributedSVM), this process only gets the
+ * merged normalization statistics. Everything that needs the training rows
+ * here (C search, threshold choice, screening, mining, deduplication, the
+ * fixed dimension, quantized, cascaded and sparse models, the benchmark and
+ * the result cache) is turned off, with a message for every option that was
+ * set.
+*/
+void SVMTestSuite::startWorkers (const Str_t &train_file)
+{
+    uint threads = std::max (1u, TaskPool::instance ().threads () / distWorkers);
+    dist.start (train_file, distWorkers, threads, robustScaling, dataClip);
+    dist.normalization (trainMean, trainPrec);
+    numFeat = dist.numFeatures ();
+    classes = dist.getClasses ();
+    for (size_t c = 0; c < classes.size (); c++)
+        assert ((classes[c] == 1 || classes[c] == -1) ||
+                !(std::cout << "Distributed training supports binary labels only.\n"));
+    assert (dist.rows () > 0 && trainMean.size () == numFeat);
+    multiClass = false;
+    auto disable = [] (bool on, const char *key)
+    {
+        if (on)
+            printf ("- %s is not available with distributed training, disabled.\n", key);
+    };
+    disable (benchmark, "Benchmark");
+    benchmark = false;
+    disable (mining, "Mining");
+    mining = false;
+    disable (dedup, "Deduplicate");
+    dedup = false;
+    fixedDim = false;
+    disable (quantized, "Quantize");
+    quantized = false;
+    disable (cascade, "Cascade");
+    cascade = false;
+    disable (sparse, "Sparse");
+    sparse = false;
+    disable (screenN > 0, "Screen");
+    screenN = 0;
+    disable (targetPrecision > 0, "TargetPrecision");
+    targetPrecision = 0;
+    disable (targetRecall > 0, "TargetRecall");
+    targetRecall = 0;
+    disable (!cacheDir.empty (), "CacheDir");
+    cacheDir = "";
+}
+
+/* Sparse hashed rows (see DataHandler::setHashing) are converted to trainSp /
+ * testSp only: binary models train on them with the dual coordinate descent
+ * solver and score the test set from them. Everything that needs the dense
+ * rows (the dlib trainer, fixed dimension, quantized, cascaded and L1 models,
+ * mining, screening, successive halving, robust scaling, raw input, the
+ * reservoir loader and distributed training) is turned off, with a message
+ * for every option that was set.
+*/
+void SVMTestSuite::sparseRowsOnly ()
+{
+    auto disable = [] (bool on, const char *key)
+    {
+        if (on)
+            printf ("- %s is not available with sparse rows, disabled.\n", key);
+    };
+    if (solver != DUAL_COORDINATE_DESCENT)
+    {
+        printf ("- Sparse rows train with the dcd solver, using it.\n");
+        setSolver (DUAL_COORDINATE_DESCENT);
+    }
+    disable (benchmark, "Benchmark");
+    benchmark = false;
+    fixedDim = false;
+    disable (quantized, "Quantize");
+    quantized = false;
+    disable (cascade, "Cascade");
+    cascade = false;
+    disable (sparse, "Sparse");
+    sparse = false;
+    disable (mining, "Mining");
+    mining = false;
+    disable (screenN > 0, "Screen");
+    screenN = 0;
+    disable (search == SUCCESSIVE_HALVING, "Search = halving");
+    if (search == SUCCESSIVE_HALVING)
+        setSearch (GRID_SEARCH);
+    disable (robustScaling, "Scaling = robust");
+    robustScaling = false;
+    DataHandler::setScaling (false, dataClip);
+    disable (rawInput, "RawInput");
+    rawInput = false;
+    DataHandler::setRawTest (false);
+    disable (reservoir, "Reservoir");
+    reservoir = false;
+    streamTest = false;
+    disable (distWorkers > 0, "Distributed training");
+    distWorkers = 0;
+}
+
+/* Incremental mode: read only the rows appended to 'feature_file' since the
+ * run that wrote 'state_file' (all rows if it does not exist yet). The rows
+ * retained in the state (support vectors) are trained on together with the
+ * new rows, using the dual coordinate descent solver warm started from the
+ * saved dual variables. Returns false if there are no new labelled rows.
+*/
+bool SVMTestSuite::loadIncremental (const Str_t &feature_file,
+                                    const Str_t &state_file)
+{
+    featureName = feature_file;
+    stateName = state_file;
+    incremental = true;
+    readConfig ();
+    assert (!sparseRows ||
+            !(std::cout << "Incremental mode does not support sparse rows.\n"));
+    if (!incState.load (state_file))
+        printf ("- No incremental state %s, reading the whole file.\n",
+                state_file.c_str ());
+    else if (incState.hashBits != DataHandler::hashingBits () ||
+             incState.hashSeed != DataHandler::hashingSeed ())
+    {
+        // The saved rows and models are in the feature space of the state
+        printf ("- Using the feature hashing of the state: %u bits, seed %lu.\n",
+                incState.hashBits, (unsigned long) incState.hashSeed);
+        DataHandler::setHashing (incState.hashBits, incState.hashSeed);
+    }
+    incState.hashBits = DataHandler::hashingBits ();
+    incState.hashSeed = DataHandler::hashingSeed ();
+    // Statistics the saved models were trained with, for the drift check
+    stateMean.clear ();
+    statePrec.clear ();
+    if (incState.moments.n > 1)
+        incState.moments.meanPrecision (stateMean, statePrec);
+    if (robustScaling && !incState.quantiles.empty ())
+        incState.quantiles.robustScaling (stateMean, statePrec);
+    DataHandler featureDat (feature_file, incState.offset, incState.moments,
+                            incState.retained, incState.quantiles);
+    trainSet = featureDat.getTrainSetConst ();
+    testSet = featureDat.getNewSetConst ();
+    rawTrainSet = featureDat.getRawTrainSetConst ();
+    trainMean = featureDat.getTrainMeanConst ();
+    trainPrec = featureDat.getTrainPrecConst ();
+    newMoments = featureDat.getMomentsConst ();
+    newQuantiles = featureDat.getQuantilesConst ();
+    newOffset = featureDat.getEndOffset ();
+    numRetained = incState.retained.size ();
+    trainRatio = 1.0;
+    numFeat = featureDat.num_feat;
+    classes = featureDat.getClasses ();
+    multiClass = featureDat.isMultiClass ();
+    assert (!multiClass ||
+            !(std::cout << "Incremental mode supports binary labels only.\n"));
+    initTrainer ();
+    setSolver (DUAL_COORDINATE_DESCENT);
+    return testSet.size () > 0;
+}
+
+/// Write the state for the next incremental run, keeping only support vectors
+void SVMTestSuite::saveState ()
+{
+    if (!incremental)
+        return;
+    incState.offset = newOffset;
+    incState.moments = newMoments;
+    incState.quantiles = newQuantiles;
+    incState.retainSupportVectors (rawTrainSet);
+    incState.save (stateName);
+}
+
+/* Before training a feature subset incrementally: if a model of the subset was
+ * saved, check it on the new rows, normalized with the statistics it was
+ * trained with. If its balanced accuracy dropped by more than driftTol from
+ * the saved one, C is searched again, otherwise the saved C is reused. The
+ * saved dual variables of the retained rows warm start the solver, the new
+ * rows start from 0.
+*/
+void SVMTestSuite::prepareIncremental (const Str_t &key)
+{
+    LinearModelState *m = incState.find (key);
+    if (m == NULL || m->w.size () != trainMat.cols () || stateMean.empty ())
+    {
+        *this << "\n- Incremental mode: no saved model for this feature set.\n";
+        threshold = configThreshold;
+        return;
+    }
+    double cpos = 0, cneg = 0, tpos = 0, tneg = 0;
+    for (size_t i = numRetained; i < rawTrainSet.size (); i++)
+    {
+        double p = m->bias;
+        for (size_t j = 0; j < m->w.size (); j++)
+        {
+            size_t f = features[j];
+            double z = (rawTrainSet[i][f] - stateMean[f]) * statePrec[f];
+            if (dataClip > 0)
+                z = std::max (-dataClip, std::min (dataClip, z));
+            p += m->w[j] * z;
+        }
+        if (labels[i] > 0)
+        {
+            tpos += 1;
+            cpos += (p >= 0);
+        }
+        else
+        {
+            tneg += 1;
+            cneg += (p < 0);
+        }
+    }
+    double acc = 0.5 * ((tpos > 0 ? cpos / tpos : 1) + (tneg > 0 ? cneg / tneg : 1));
+    *this << "\n- Incremental mode: saved accuracy" << m->acc
+          << ", accuracy on new rows" << acc << "\n";
+    if (m->acc - acc > driftTol)
+    {
+        std::cout << "Drift detected (" << m->acc << " -> " << acc
+                  << "), searching C again.\n";
+        priorC1 = m->C1;
+        priorC2 = m->C2;
+        C1 = 0;
+        C2 = 0;
+    }
+    else
+    {
+        setPosC (m->C1);
+        setNegC (m->C2);
+        cvAcc = m->acc;
+    }
+    if (targetPrecision <= 0 && targetRecall <= 0)
+        threshold = m->threshold;
+    warmAlpha.assign (trainMat.rows (), 0.0);
+    std::map<size_t, double>::const_iterator it;
+    for (it = m->alpha.begin (); it != m->alpha.end (); ++it)
+        if (it->first < numRetained)
+            warmAlpha[it->first] = it->second;
+}
+
+void SVMTestSuite::recordIncremental (const Str_t &key)
+{
+    LinearModelState m;
+    m.key = key;
+    m.C1 = C1;
+    m.C2 = C2;
+    if (cvAcc < 0)
+    {
+        dlib::matrix<double,1,2> acc;
+        if (fixed)
+        {
+            vecD_t scores;
+            fixed->trainScores (scores);
+            acc = accuracy (scores, labels);
+        }
+        else
+        {
+            // Incremental training uses the dual solver, scored on trainMat
+            vecD_t scores (trainMat.rows ());
+            for (size_t i = 0; i < scores.size (); i++)
+                scores[i] = dcd.predict (trainMat.row (i));
+            acc = accuracy (scores, labels);
+        }
+        cvAcc = 0.5 * (acc(0) + acc(1));
+    }
+    m.acc = cvAcc;
+    m.w = dcd.getWeights ();
+    m.bias = dcd.getBias ();
+    m.threshold = threshold;
+    for (size_t i = 0; i < dcd.getAlpha ().size (); i++)
+        if (dcd.getAlpha ()[i] > 0)
+            m.alpha[i] = dcd.getAlpha ()[i];
+    incState.update (m);
+}
+
+/// Read the [svm], [paths] and [incremental] keys of config/ranking.ini, before
+/// the data is loaded since some of them change how it is read
+void SVMTestSuite::readConfig ()
 {
-    trainer.set_c (0);
     INIReader reader("config/ranking.ini");
     if (reader.ParseError() < 0)
     {
@@ -100,6 +455,153 @@ void SVMTestSuite::initTrainer ()
     }
 
     pathName = reader.Get("paths", "ClipsFolder", "");
+    if (reader.Get("svm", "Solver", "dlib") == "dcd")
+        setSolver (DUAL_COORDINATE_DESCENT);
+    benchmark = reader.GetBoolean("svm", "Benchmark", false);
+    driftTol = reader.GetReal("incremental", "DriftTolerance", 0.02);
+    if (reader.Get("svm", "Search", "grid") == "halving")
+        setSearch (SUCCESSIVE_HALVING);
+    halvingEta = reader.GetReal("svm", "HalvingEta", 3.0);
+    if (halvingEta <= 1)
+    {
+        // Neither grows the subsample nor cuts the candidates
+        printf ("- HalvingEta %g must be greater than 1, using 2.\n", halvingEta);
+        halvingEta = 2.0;
+    }
+    halvingMinFraction = reader.GetReal("svm", "HalvingMinFraction", 0.1);
+    if (reader.Get("svm", "Search", "grid") == "adaptive")
+        setSearch (ADAPTIVE_SEARCH);
+    adaptiveTol = reader.GetReal("svm", "AdaptiveTolerance", 0.1);
+    adaptiveMaxEvals = reader.GetInteger("svm", "AdaptiveMaxEvals", 8);
+    perClassC = reader.GetBoolean("svm", "PerClassC", false);
+    configThreshold = reader.GetReal("svm", "Threshold", 0.0);
+    threshold = configThreshold;
+    targetPrecision = reader.GetReal("svm", "TargetPrecision", 0.0);
+    targetRecall = reader.GetReal("svm", "TargetRecall", 0.0);
+    screenN = reader.GetInteger("svm", "Screen", 0);
+    screenLambda = reader.GetReal("svm", "ScreenLambda", 1.0);
+    fixedDim = reader.GetBoolean("svm", "FixedDimension", true);
+    quantized = reader.GetBoolean("svm", "Quantize", false);
+    quantizeClip = reader.GetReal("svm", "QuantizeClip", 4.0);
+    dedup = reader.GetBoolean("svm", "Deduplicate", false) && !incremental;
+    DataHandler::setDeduplicate (dedup);
+    // The L1 path replaces the C search and the dual solver of mining and
+    // of the incremental mode
+    sparse = reader.GetBoolean("svm", "Sparse", false) && !incremental;
+    sparseL1Ratio = reader.GetReal("svm", "SparseL1Ratio", 1.0);
+    sparsePathLength = reader.GetInteger("svm", "SparsePathLength", 20);
+    sparsePathRatio = reader.GetReal("svm", "SparsePathRatio", 0.01);
+    sparseTol = reader.GetReal("svm", "SparseTolerance", 0.01);
+    mining = reader.GetBoolean("svm", "Mining", false) && !sparse;
+    miningRounds = reader.GetInteger("svm", "MiningRounds", 10);
+    cacheDir = reader.Get("svm", "CacheDir", "");
+    dataClip = reader.GetReal("data", "Clip", 0.0);
+    // Dense hashed rows hold 2^bits values each, sparse ones their non-zeros
+    long hashBits = reader.GetInteger("data", "HashBits", 0);
+    sparseRows = reader.GetBoolean("data", "SparseRows", false);
+    if (sparseRows && hashBits <= 0)
+    {
+        printf ("- SparseRows needs [data] HashBits, disabled.\n");
+        sparseRows = false;
+    }
+    if (!sparseRows && hashBits > 16)
+    {
+        printf ("HashBits = %ld makes rows of 2^%ld values, using 16 "
+                "(or set SparseRows).\n", hashBits, hashBits);
+        hashBits = 16;
+    }
+    if (sparseRows && hashBits > 22)
+    {
+        printf ("HashBits = %ld makes models of 2^%ld weights, using 22.\n", hashBits, hashBits);
+        hashBits = 22;
+    }
+    DataHandler::setHashing (std::max (0L, hashBits),
+                             std::stoull (reader.Get("data", "HashSeed", "0"), NULL, 0),
+                             sparseRows);
+    robustScaling = reader.Get("data", "Scaling", "standard") == "robust";
+    DataHandler::setScaling (robustScaling, dataClip);
+    // Clipping is not linear and the benchmark and incremental mode score
+    // normalized samples, the normalization cannot be folded there
+    rawInput = reader.GetBoolean("svm", "RawInput", false) && dataClip == 0 &&
+               !benchmark && !incremental;
+    DataHandler::setRawTest (rawInput);
+    cascade = reader.GetBoolean("svm", "Cascade", false) && !sparse;
+    cascadeBlock = reader.GetInteger("svm", "CascadeBlock", 4);
+    reservoir = reader.GetBoolean("data", "Reservoir", false);
+    if (mining && reservoir)
+    {
+        // The reservoir loader keeps no rows beside its sample to mine from
+        printf ("- Mining needs the rows class balancing leaves out, not "
+                "available with [data] Reservoir: mining disabled.\n");
+        mining = false;
+    }
+    streamTest = reader.GetBoolean("data", "StreamTest", false) && reservoir;
+    streamBatch = std::max (1L, reader.GetInteger("data", "StreamBatch", 65536));
+    TaskPool::instance ().configure (reader.GetInteger("parallel", "Threads", 0),
+                                     reader.GetBoolean("parallel", "Affinity", false),
+                                     reader.GetBoolean("parallel", "Stats", false));
+    distWorkers = reader.GetInteger("distributed", "Workers", 0);
+    if (sparseRows)
+        sparseRowsOnly ();
+    dist.setMethod (reader.Get("distributed", "Method", "admm") == "mixing" ?
+                    MIX_AVERAGE : MIX_ADMM);
+    dist.setRho (reader.GetReal("distributed", "Rho", 10.0));
+    dist.setMaxIterations (reader.GetInteger("distributed", "MaxIterations", 200));
+    dist.setTolerance (reader.GetReal("distributed", "Tolerance", 1e-3));
+}
+
+void SVMTestSuite::initTrainer ()
+{
+    assert (!sparseRows || !multiClass ||
+            !(std::cout << "Sparse rows support binary labels only.\n"));
+    // The L1 path trains one binary model, train () never reaches it in
+    // multi-class mode
+    if (sparse && multiClass)
+    {
+        printf ("- Sparse trains binary models only, disabled for %lu classes.\n",
+                (unsigned long) classes.size ());
+        sparse = false;
+    }
+    trainer.set_c (0);
+    // The training set was deduplicated by DataHandler. The dual coordinate
+    // descent solver weights every sample, the dlib trainer only has a C per
+    // class: the benchmark gives it the mean weight of the class, which keeps
+    // the total weight of every class but not that of the single rows.
+    posCWeight = 1.0;
+    negCWeight = 1.0;
+    if (dedup)
+    {
+        double npos = 0, nneg = 0, wpos = 0, wneg = 0;
+        for (size_t i = 0; i < trainSet.size (); i++)
+        {
+            ((trainSet[i].getLabel () > 0) ? npos : nneg) += 1;
+            ((trainSet[i].getLabel () > 0) ? wpos : wneg) += trainSet[i].getWeight ();
+        }
+        posCWeight = (npos > 0) ? wpos / npos : 1.0;
+        negCWeight = (nneg > 0) ? wneg / nneg : 1.0;
+        if (solver == DLIB_CUTTING_PLANE && !multiClass)
+        {
+            printf ("- Deduplicated rows are weighted by the dcd solver only, using it.\n");
+            setSolver (DUAL_COORDINATE_DESCENT);
+        }
+    }
+    if (mining && poolSet.size () > 0 && solver == DLIB_CUTTING_PLANE && !multiClass)
+    {
+        printf ("- Hard example mining warm starts the dcd solver, using it.\n");
+        setSolver (DUAL_COORDINATE_DESCENT);
+    }
+    // Content hash of the training set for the keys of the result cache
+    if (cache.open (cacheDir))
+    {
+        vec<uint64_t> rowHash (trainSet.size ());
+        TaskPool::instance ().parallelFor ("hash rows", 0, trainSet.size (), 0, [&] (size_t i) {
+            rowHash[i] = DataHandler::hashSample (trainSet[i]) ^
+                         ((uint64_t) trainSet[i].getWeight () << 32);
+        });
+        dataHash = 14695981039346656037ULL;
+        for (size_t i = 0; i < rowHash.size (); i++)
+            dataHash = (dataHash ^ rowHash[i]) * 1099511628211ULL;
+    }
 
     dlib::matrix<double> work_around;
     work_around = dlib::ones_matrix<double> (numFeat, 1);
@@ -122,14 +624,18 @@ void SVMTestSuite::setTestMode (TESTMODE_t testMode,
 {
     *this << "############ New Test Mode Set ###########\n";
     vec<size_t> featureSet;
+    Str_t key, num;
+    cvAcc = -1;
     switch (testMode)
     {
         case CUSTOM:
             featureSet = feature_set;
             *this << "- Mode set to CUSTOM\n";
             *this << "    - Using the following features for training: ";
-            for (size_t i = 0; i < featureSet.size (); i++)
+            for (size_t i = 0; i < std::min (featureSet.size (), (size_t) 64); i++)
                 *this << featureSet[i] << " ";
+            if (featureSet.size () > 64)
+                *this << "... (" << featureSet.size () << " features)";
             *this << "\n";
             break;
         case SINGLE_USE_ALL_FEATURES:
@@ -138,9 +644,134 @@ void SVMTestSuite::setTestMode (TESTMODE_t testMode,
                 featureSet.push_back (k);
     }
 
-    dataHandlerToDlib (trainSet, samples, labels, featureSet);
-    dataHandlerToDlib (testSet, testSamples, testLabels, featureSet);
-    if (C1 == 0 || C2 == 0)
+    features = featureSet;
+    // Mining appends to the weights of the working set, start over
+    trainWeights.clear ();
+    if (dedup)
+        for (size_t i = 0; i < trainSet.size (); i++)
+            trainWeights.push_back (trainSet[i].getWeight ());
+    dcd.setSampleWeights (sampleWeights ());
+    ovr.setSampleWeights (sampleWeights ());
+    // Subsets of up to 64 features use samples of compile time dimension,
+    // the benchmark compares against the dynamic dlib path
+    fixed.reset ((fixedDim && !multiClass && !benchmark) ?
+                 makeFixedDim (featureSet.size ()) : NULL);
+    if (sparseRows)
+    {
+        labels.clear ();
+        testLabels.clear ();
+        samples.clear ();
+        testSamples.clear ();
+        dataHandlerLabelsToDlib (trainSet, labels);
+        dataHandlerLabelsToDlib (testSet, testLabels);
+        dataHandlerToSparse (trainSet, featureSet, numFeat, trainSp);
+        dataHandlerToSparse (testSet, featureSet, numFeat, testSp);
+        foldAlpha.clear ();
+        *this << "- Sparse rows, non-zeros:" << trainSp.idx.size () << "\n";
+    }
+    else if (fixed)
+    {
+        fixed->setData (trainSet, rawInput ? vecS_t () : testSet, featureSet);
+        labels.clear ();
+        testLabels.clear ();
+        dataHandlerLabelsToDlib (trainSet, labels);
+        if (!streamTest)
+            dataHandlerLabelsToDlib (testSet, testLabels);
+        samples.clear ();
+        testSamples.clear ();
+        *this << "- Fixed dimension samples:" << (size_t) fixed->dimension () << "\n";
+    }
+    else
+    {
+        // The dual coordinate descent solver and the one-vs-rest models
+        // train on trainMat, multi-class scoring uses testMat: no dlib
+        // copies of those rows
+        bool dlibTrain = benchmark || (solver != DUAL_COORDINATE_DESCENT && !multiClass);
+        samples.clear ();
+        labels.clear ();
+        if (!dist.running () && dlibTrain)
+            dataHandlerToDlib (trainSet, samples, labels, featureSet);
+        else if (!dist.running ())
+            dataHandlerLabelsToDlib (trainSet, labels);
+        testSamples.clear ();
+        testLabels.clear ();
+        if ((rawInput || (multiClass && !benchmark)) && !streamTest)
+            dataHandlerLabelsToDlib (testSet, testLabels);
+        else if (!streamTest)
+            dataHandlerToDlib (testSet, testSamples, testLabels, featureSet);
+    }
+    if ((solver == DUAL_COORDINATE_DESCENT || benchmark || multiClass || incremental ||
+         search == SUCCESSIVE_HALVING || sparse) && !dist.running () && !sparseRows)
+    {
+        dataHandlerToRowMajor (trainSet, featureSet, trainMat);
+        foldAlpha.clear ();
+    }
+    poolMat = FeatureMatrix ();
+    if (mining && poolSet.size () > 0 && !multiClass && !benchmark)
+    {
+        dataHandlerToRowMajor (poolSet, featureSet, poolMat);
+        poolLabels.clear ();
+        dataHandlerLabelsToDlib (poolSet, poolLabels);
+    }
+    if (incremental)
+    {
+        for (size_t i = 0; i < featureSet.size (); i++)
+            key += (i ? "," : "") + stringify (featureSet[i] + 1, num);
+        prepareIncremental (key);
+    }
+    if (multiClass)
+    {
+        dataHandlerToRowMajor (testSet, featureSet, testMat);
+        *this << "\n- One-vs-rest multi-class mode with" << classes.size ()
+              << "classes\n";
+    }
+    Str_t result;
+    if (cache.enabled ())
+    {
+        std::stringstream ck;
+        ck << "data=" << std::hex << dataHash << std::dec << " rows=" << trainSet.size ()
+           << " solver=" << solver << " eps=" << std::setprecision (17)
+           << ((solver == DUAL_COORDINATE_DESCENT) ? dcd.getEpsilon () : trainer.get_epsilon ())
+           << " nfold=" << nfold;
+        if (DataHandler::hashingBits () > 0)
+            ck << " hashing=" << DataHandler::hashingBits () << "/" << DataHandler::hashingSeed ()
+               << (sparseRows ? "/sparse" : "");
+        ck << " features=";
+        for (size_t i = 0; i < featureSet.size (); i++)
+            ck << (i ? "," : "") << featureSet[i] + 1;
+        cvKey = ck.str ();
+        if (!multiClass && !incremental && !benchmark && poolMat.rows () == 0)
+        {
+            result = resultKey ();
+            if (cachedResult (result))
+                return;
+        }
+    }
+    if ((C1 == 0 || C2 == 0) && sparse && !multiClass && !dist.running ())
+    {
+        printf ("- The L1 path replaces the C search, using 1 as class weight.\n");
+        setPosC (C1 > 0 ? C1 : 1.0);
+        setNegC (C2 > 0 ? C2 : 1.0);
+    }
+    if ((C1 == 0 || C2 == 0) && dist.running ())
+    {
+        printf ("- Distributed training does not search C, using 1.\n");
+        setPosC (C1 > 0 ? C1 : 1.0);
+        setNegC (C2 > 0 ? C2 : 1.0);
+    }
+    if ((C1 == 0 || C2 == 0) && search == SUCCESSIVE_HALVING && !multiClass)
+    {
+        successiveHalving ();
+        *this << "- Finding best C1, C2 using successive halving.\n"
+              << "Best C1: " << '\t' << C1 << "\tBest C2: " << '\t' << C2;
+    }
+    else if ((C1 == 0 || C2 == 0) && search == ADAPTIVE_SEARCH)
+    {
+        adaptiveSearchC ();
+        *this << "- Finding best C1, C2 using adaptive search.\n"
+              << "Best C1: " << '\t' << C1 << "\tBest C2: " << '\t' << C2;
+    }
+    else if (C1 == 0 || C2 == 0)
     {
         crossValidateBestC ();
         *this << "- Finding best C using cross validation.\n"
@@ -150,13 +781,272 @@ void SVMTestSuite::setTestMode (TESTMODE_t testMode,
         *this << "- Using the user input \n\t- C1: " << "\t" << C1
               << "\n\t- C2: " << "\t" << C2;
     train (samples, labels);
+    if (poolMat.rows () > 0)
+        mineHardExamples ();
+    if (!multiClass)
+        chooseThreshold ();
+    if (result.size () > 0)
+        storeResult (result);
+    if (incremental)
+        recordIncremental (key);
+    if (benchmark)
+        benchmarkSolvers ();
+}
+
+/* Rank the feature subsets by the cross validated error of a ridge / LDA
+ * classifier computed from cached Gram matrices (see GramCache) and return the
+ * indices of the [svm] Screen best ones, in their original order. Only those
+ * are worth the full SVM training and C search.
+*/
+vec<size_t> SVMTestSuite::screenSubsets (const vec<vec<size_t> > &subsets)
+{
+    if (gram.empty ())
+    {
+        gram.setLambda (screenLambda);
+        gram.compute (trainSet, nfold);
+    }
+    vecD_t err (subsets.size ());
+    TaskPool::instance ().parallelFor ("screen subset", 0, subsets.size (), 1, [&] (size_t i) {
+        err[i] = gram.crossValidate (subsets[i]);
+    });
+
+    vec<size_t> order (subsets.size ());
+    for (size_t i = 0; i < order.size (); i++)
+        order[i] = i;
+    std::stable_sort (order.begin (), order.end (),
+                      [&] (size_t a, size_t b) { return err[a] < err[b]; });
+    size_t keep = std::min ((size_t) screenN, order.size ());
+    std::cout << "- Screened " << subsets.size () << " feature subsets, keeping "
+              << keep << ":\n";
+    for (size_t r = 0; r < keep; r++)
+    {
+        std::cout << "\t" << std::setprecision (4) << err[order[r]] << "\t";
+        for (size_t j = 0; j < subsets[order[r]].size (); j++)
+            std::cout << (j ? "," : "") << subsets[order[r]][j] + 1;
+        std::cout << "\n";
+    }
+    order.resize (keep);
+    std::sort (order.begin (), order.end ());
+    return order;
 }
 
 void SVMTestSuite::train (const vec<sample_type> &s, const vec<label_t> &l)
 {
     std::cout << "C1: " << std::setprecision (2) << std::setw (3) << C1
               << "\t\tC2: " << std::setprecision (2) << std::setw (3) << C2;
-    learned_function.function = trainer.train (s, l);
+    if (multiClass)
+    {
+        ovr.setClasses (classes);
+        ovr.setPosC (C1);
+        ovr.setNegC (C2);
+        ovr.train (trainMat, l);
+    }
+    else if (dist.running ())
+    {
+        vecD_t w;
+        double bias;
+        dist.train (features, C1, C2, w, bias);
+        learned_function.function = linearToDlib (w, bias);
+    }
+    else if (sparse)
+        trainSparse (l);
+    else if (sparseRows)
+    {
+        vec<size_t> rows (trainSp.rows ());
+        for (size_t i = 0; i < rows.size (); i++)
+            rows[i] = i;
+        dcd.setPosC (C1);
+        dcd.setNegC (C2);
+        dcd.train (trainSp, l, rows);
+        learned_function.function = linearToDlib (dcd.getWeights (), dcd.getBias ());
+    }
+    else if (solver == DUAL_COORDINATE_DESCENT)
+    {
+        dcd.setPosC (C1);
+        dcd.setNegC (C2);
+        if (warmAlpha.size () == trainMat.rows ())
+            dcd.warmStart (warmAlpha);
+        warmAlpha.clear ();
+        dcd.train (trainMat, l);
+        if (fixed)
+            fixed->setHyperplane (dcd.getWeights (), dcd.getBias ());
+        else
+            learned_function.function = linearToDlib (dcd.getWeights (), dcd.getBias ());
+    }
+    else if (fixed)
+        fixed->train (l, C1 * posCWeight, C2 * negCWeight);
+    else
+    {
+        trainer.set_c_class1 (C1 * posCWeight);
+        trainer.set_c_class2 (C2 * negCWeight);
+        learned_function.function = trainer.train (s, l);
+    }
+}
+
+/// Wrap the hyperplane w' x + bias in the decision function type used by dlib
+dec_funct_type linearToDlib (const vecD_t &w, double bias)
+{
+    dec_funct_type df;
+    sample_type wv;
+    wv.set_size (w.size (), 1);
+    for (size_t j = 0; j < w.size (); j++)
+        wv(j) = w[j];
+    df.alpha.set_size (1, 1);
+    df.alpha(0) = 1;
+    df.basis_vectors.set_size (1, 1);
+    df.basis_vectors(0) = wv;
+    df.b = -bias;
+    return df;
+}
+
+/* Key of the final result of setTestMode in the cache: the cross validation
+ * key (data, solver and its tolerance, folds, features) plus the user given
+ * C1 / C2 (0 means searched) and every parameter of the search and the
+ * threshold choice. The threshold is an input only without a target
+ * precision / recall; with one it is a result, and chooseThreshold
+ * overwrites it after every experiment.
+*/
+Str_t SVMTestSuite::resultKey () const
+{
+    std::stringstream k;
+    k << std::setprecision (17) << cvKey << " C1=" << C1 << " C2=" << C2
+      << " search=" << search;
+    if (search == SUCCESSIVE_HALVING)
+        k << " eta=" << halvingEta << " minFraction=" << halvingMinFraction;
+    if (search == ADAPTIVE_SEARCH)
+        k << " tol=" << adaptiveTol << " maxEvals=" << adaptiveMaxEvals
+          << " perClassC=" << perClassC << " prior=" << priorC1 << "," << priorC2;
+    if (targetPrecision <= 0 && targetRecall <= 0)
+        k << " threshold=" << threshold;
+    else
+        k << " precision=" << targetPrecision << " recall=" << targetRecall;
+    if (sparse)
+        k << " sparse=" << sparseL1Ratio << "," << sparsePathLength << ","
+          << sparsePathRatio << "," << sparseTol;
+    k << " result";
+    return k.str ();
+}
+
+/// Restore C1, C2, the cross validation accuracy, threshold and hyperplane of
+/// an identical earlier experiment (with Sparse also its L1 path, reported
+/// again), false if it is not in the cache
+bool SVMTestSuite::cachedResult (const Str_t &key)
+{
+    CVRecord r;
+    vec<Str_t> required = { "C", "cvAcc", "threshold", "bias", "w" };
+    if (sparse)
+    {
+        required.push_back ("sparseChosen");
+        required.push_back ("sparsePath");
+    }
+    if (!cache.get (key, r, required) || r["C"].size () != 2 ||
+        r["w"].size () != features.size ())
+        return false;
+    C1 = r["C"][0];
+    C2 = r["C"][1];
+    trainer.set_c_class1 (C1);
+    trainer.set_c_class2 (C2);
+    cvAcc = r["cvAcc"].at (0);
+    threshold = r["threshold"].at (0);
+    const vecD_t &w = r["w"];
+    double bias = r["bias"].at (0);
+    if (fixed)
+        fixed->setHyperplane (w, bias);
+    else
+        learned_function.function = linearToDlib (w, bias);
+    std::cout << "- Cached result: C1: " << C1 << "  C2: " << C2
+              << "  threshold: " << threshold << "\n";
+    *this << "- Cached result\n\t- C1: " << "\t" << C1
+          << "\n\t- C2: " << "\t" << C2;
+    if (sparse)
+    {
+        sparseModel = SparseLinearModel (w, bias, features);
+        sparseChosen = (size_t) r["sparseChosen"].at (0);
+        sparsePath = r["sparsePath"];
+        sparseOof.clear ();
+        printSparseModel ();
+    }
+    return true;
+}
+
+void SVMTestSuite::storeResult (const Str_t &key)
+{
+    CVRecord r;
+    double bias;
+    hyperplane (r["w"], bias);
+    r["C"] = { C1, C2 };
+    r["cvAcc"] = { cvAcc };
+    r["threshold"] = { threshold };
+    r["bias"] = { bias };
+    if (sparse)
+    {
+        r["sparseChosen"] = { (double) sparseChosen };
+        r["sparsePath"] = sparsePath;
+    }
+    cache.put (key, r);
+    std::cout << "\n- Cross validation cache hits: " << cache.getHits ()
+              << "  misses: " << cache.getMisses () << "\n";
+}
+
+/* Hard example mining / active set training
+ *
+ * The model trained on the balanced training set scores every row of the
+ * mining pool (the rows balancing left out) in parallel. Pool rows violating
+ * the margin, y f(x) < 1, are appended to the working set (trainMat, labels)
+ * and the dual coordinate descent solver is warm started from the current
+ * dual variables, the new rows starting at 0. Repeats until no pool row
+ * violates the margin or [svm] MiningRounds rounds are done, so the model
+ * fits the whole pool while only training on its informative rows.
+*/
+void SVMTestSuite::mineHardExamples ()
+{
+    vec<char> added (poolMat.rows (), 0);
+    vecD_t f (poolMat.rows ());
+    size_t total = 0;
+    for (uint r = 0; r < miningRounds; r++)
+    {
+        TaskPool::instance ().parallelFor ("score pool", 0, poolMat.rows (), 0, [&] (size_t i) {
+            f[i] = dcd.predict (poolMat.row (i));
+        });
+        vec<size_t> violators;
+        for (size_t i = 0; i < poolMat.rows (); i++)
+            if (!added[i] && ((poolLabels[i] > 0) ? f[i] : -f[i]) < 1)
+                violators.push_back (i);
+        printf ("\n- Mining round %u: %lu margin violators in a pool of %lu, "
+                "working set %lu.\n", r + 1, violators.size (), poolMat.rows (),
+                trainMat.rows ());
+        if (violators.size () == 0)
+            break;
+
+        const size_t n0 = trainMat.rows (), d = trainMat.cols ();
+        trainMat.data.resize ((n0 + violators.size ()) * d);
+        trainMat.nr = n0 + violators.size ();
+        for (size_t k = 0; k < violators.size (); k++)
+        {
+            std::copy (poolMat.row (violators[k]), poolMat.row (violators[k]) + d,
+                       trainMat.row (n0 + k));
+            labels.push_back (poolLabels[violators[k]]);
+            if (trainWeights.size () > 0)
+                trainWeights.push_back (1.0);
+            added[violators[k]] = 1;
+        }
+        total += violators.size ();
+        warmAlpha = dcd.getAlpha ();
+        warmAlpha.resize (trainMat.rows (), 0.0);
+        train (samples, labels);
+    }
+    *this << "\n- Hard example mining added" << total << "pool rows, working set:"
+          << trainMat.rows ();
+}
+
+/// Hyperplane of a linear kernel decision function: w = sum alpha_i basis_i
+void dlibToLinear (const dec_funct_type &df, vecD_t &w, double &bias)
+{
+    w.assign (df.basis_vectors.size () ? df.basis_vectors(0).size () : 0, 0.0);
+    for (long i = 0; i < df.basis_vectors.size (); i++)
+        for (size_t j = 0; j < w.size (); j++)
+            w[j] += df.alpha(i) * df.basis_vectors(i)(j);
+    bias = -df.b;
 }
 
 void SVMTestSuite::setC (double C_)
@@ -209,16 +1099,14 @@ void SVMTestSuite::crossValidateBestC ()
     std::cout << "First performing coarse Grid Search using cross validation: " << std::endl;
     for (double C = 1; C < 10000; C *= 5)
     {
-        trainer.set_c_class1 (C);
-        trainer.set_c_class2 (C);
-
         std::cout << "C: " << std::setw(5) << C;
-        acc = dlib::cross_validate_trainer(trainer, samples, labels, nfold);
+        acc = crossValidate (C, C);
         std::cout << "     cross validation accuracy: "
              << acc;
         if (acc(0) * acc(1) > max_acc)
         {
             max_acc = acc(0) + 0.5 * acc(1);
+            cvAcc = 0.5 * (acc(0) + acc(1));
             C_ = C;
         }
     }
@@ -228,15 +1116,14 @@ void SVMTestSuite::crossValidateBestC ()
          << C_ - C_ / 2 << ", " << C_ + C_ / 2 << "] increment by " << C_ / 5 << std::endl;
     for (double C = C_ - C_/2; C < C_ + C_/2; C += C_ / 5)
     {
-        trainer.set_c_class1 (C);
-        trainer.set_c_class2 (C);
         std::cout << "C: " << C;
-        acc = dlib::cross_validate_trainer(trainer, samples, labels, nfold);
+        acc = crossValidate (C, C);
         std::cout << "     cross validation accuracy: "
              << acc;
         if (acc(0) * acc(1) > max_acc)
         {
             max_acc = acc(0) + 0.5 * acc(1);
+            cvAcc = 0.5 * (acc(0) + acc(1));
             C_ = C;
         }
     }
@@ -244,68 +1131,879 @@ void SVMTestSuite::crossValidateBestC ()
     trainer.set_c (C_);
     C1 = C_;
     C2 = C_;
+    priorC1 = C_;
+    priorC2 = C_;
 }
 
-void SVMTestSuite::classify ()
+/* Successive halving (Hyperband style) search for C1 and C2
+ *
+ * All pairs of C1, C2 from the coarse grid of crossValidateBestC are cross
+ * validated on a stratified subsample of halvingMinFraction of the training
+ * rows. Only the best 1 / halvingEta of the candidates survive to the next
+ * round, whose subsample is halvingEta times larger, until one candidate is
+ * left or the subsample is the full training set. The subsamples are nested
+ * prefixes of one random permutation of every class. The candidates of a
+ * round are cross validated in parallel with the dual coordinate descent
+ * solver, each on its own lists of rows into the shared trainMat.
+ *
+ * Reports the number of training samples processed (summed over all folds
+ * and candidates) against the exhaustive grid on the full training set.
+*/
+void SVMTestSuite::successiveHalving ()
 {
-    classify (testSamples, testLabels);
+    vec<std::pair<double, double> > cand;
+    for (double Cp = 1; Cp < 10000; Cp *= 5)
+        for (double Cn = 1; Cn < 10000; Cn *= 5)
+            cand.push_back (std::make_pair (Cp, Cn));
+    const size_t numCand = cand.size ();
+
+    // Random permutation of every class, subsamples are prefixes of these
+    vec<size_t> pos, neg;
+    for (size_t i = 0; i < labels.size (); i++)
+        (labels[i] > 0 ? pos : neg).push_back (i);
+    std::mt19937 rng (12345);
+    std::shuffle (pos.begin (), pos.end (), rng);
+    std::shuffle (neg.begin (), neg.end (), rng);
+
+    const size_t n = labels.size ();
+    double frac = std::min (1.0, halvingMinFraction);
+    size_t evaluations = 0;
+    vecD_t score (numCand), balanced (numCand);
+    std::cout << "Successive halving over " << numCand << " (C1, C2) candidates:\n";
+    while (true)
+    {
+        size_t np = std::max ((size_t) nfold, (size_t) std::ceil (frac * pos.size ()));
+        size_t nn = std::max ((size_t) nfold, (size_t) std::ceil (frac * neg.size ()));
+        vec<size_t> rows (pos.begin (), pos.begin () + std::min (np, pos.size ()));
+        rows.insert (rows.end (), neg.begin (), neg.begin () + std::min (nn, neg.size ()));
+
+        vec<size_t> evals (cand.size ());
+        TaskPool::instance ().parallelFor ("halving candidate", 0, cand.size (), 1, [&] (size_t c) {
+            DCDSolver s;
+            s.setSampleWeights (sampleWeights ());
+            vec<vecD_t> alphas;
+            double accPos, accNeg;
+            s.setPosC (cand[c].first);
+            s.setNegC (cand[c].second);
+            evals[c] = dcdCrossValidate (s, trainMat, labels, rows, nfold,
+                                         alphas, accPos, accNeg);
+            score[c] = accPos * accNeg;
+            balanced[c] = 0.5 * (accPos + accNeg);
+        });
+        for (size_t c = 0; c < cand.size (); c++)
+            evaluations += evals[c];
+
+        vec<size_t> order (cand.size ());
+        for (size_t c = 0; c < order.size (); c++)
+            order[c] = c;
+        std::stable_sort (order.begin (), order.end (),
+                          [&] (size_t a, size_t b) { return score[a] > score[b]; });
+        std::cout << "- " << rows.size () << " samples, " << cand.size ()
+                  << " candidates, best C1: " << cand[order[0]].first << " C2: "
+                  << cand[order[0]].second << " score: " << score[order[0]] << "\n";
+
+        size_t keep = (size_t) std::ceil (cand.size () / halvingEta);
+        vec<std::pair<double, double> > next;
+        for (size_t c = 0; c < keep; c++)
+            next.push_back (cand[order[c]]);
+        cvAcc = balanced[order[0]];
+        cand = next;
+        if (rows.size () >= n || cand.size () == 1)
+            break;
+        frac *= halvingEta;
+    }
+    size_t exhaustive = numCand * (n - n / nfold) * nfold;
+    std::cout << "Training samples processed: " << evaluations << " (exhaustive grid: "
+              << exhaustive << ", " << std::setprecision (3)
+              << 100.0 * evaluations / exhaustive << "%)\n";
+    *this << "\n- Successive halving processed" << evaluations
+          << "training samples, exhaustive grid" << exhaustive << "\n";
+    setPosC (cand[0].first);
+    setNegC (cand[0].second);
+    priorC1 = C1;
+    priorC2 = C2;
 }
 
-void SVMTestSuite::classify (const vec<sample_type> &s, const vec<label_t> &l)
+/* Adaptive search for C replacing the fixed coarse + fine grid
+ *
+ * Single C (C1 = C2): golden section search on log10(C). Per-class C
+ * ([svm] PerClassC = true): pattern search on (log10(C1), log10(C2)).
+ * The objective is the same cross validation score as in crossValidateBestC.
+ * The last best C (or the saved C of an incremental model) is the prior:
+ * the golden section bracket is one decade around it and the pattern search
+ * starts from it. Without a prior the bracket is the coarse grid range
+ * [1, 10000]. Stops after AdaptiveTolerance decades or AdaptiveMaxEvals
+ * cross validations.
+*/
+void SVMTestSuite::adaptiveSearchC ()
 {
-    Str_t ing = "interesting";
-    Str_t ning = "not_interesting";
-    *this << "\n#####################" << "\nStarting classification:"
-          << "\n#####################";
-    *this << "\n---------------------------------------------------------------------------------------------------------------";
-    *this << "\nSr #\t\t|\t\t" << "Prediction" << "\t|\t" << "Original"
-          << "\t|\t\t" << "Comments";
-    *this << "\n---------------------------------------------------------------------------------------------------------------";
-    assert ((s.size () > 0 && l.size () > 0) ||
-            !(std::cout << "Test set size 0. Run setTestMode first.\n"));
-    float epos = 0, eneg = 0, tpos = 0, tneg = 0;
-    label_t p = 0;
-    for (size_t k = 0; k < s.size (); k++)
+    std::map<std::pair<double, double>, double> balancedAcc;
+    auto f = [&] (double Cp, double Cn)
+    {
+        dlib::matrix<double,1,2> acc = crossValidate (Cp, Cn);
+        std::cout << "C1: " << std::setw(9) << Cp << "  C2: " << std::setw(9) << Cn
+                  << "     cross validation accuracy: " << acc;
+        balancedAcc[std::make_pair (Cp, Cn)] = 0.5 * (acc(0) + acc(1));
+        return acc(0) * acc(1);
+    };
+    SearchResult res;
+    if (perClassC)
+    {
+        double x = (priorC1 > 0) ? std::log10 (priorC1) : 1.0;
+        double y = (priorC2 > 0) ? std::log10 (priorC2) : 1.0;
+        std::cout << "Pattern search for C1, C2 from (" << std::pow (10.0, x)
+                  << ", " << std::pow (10.0, y) << "):\n";
+        res = patternSearch (f, x, y, (priorC1 > 0) ? 0.25 : 0.5,
+                             adaptiveTol, adaptiveMaxEvals);
+    }
+    else
     {
-        p = learned_function(s[k]);
-        *this << "\n#" << k+1 << "\t\t|\t\t" << ((int) (p * 10000)) / 100000.0 + 0.000011
-              << "\t\t:\t\t" << l[k] << "\t\t|\t\t" << testSet[k].getComments ();
-        if (l[k] < 0)
+        double lo = 0.0, hi = 4.0;
+        if (priorC1 > 0)
         {
-            tneg += 1;
-            if (p > 0)
+            lo = std::log10 (priorC1) - 1.0;
+            hi = std::log10 (priorC1) + 1.0;
+        }
+        std::cout << "Golden section search for C in [" << std::pow (10.0, lo)
+                  << ", " << std::pow (10.0, hi) << "]:\n";
+        res = goldenSectionSearch ([&] (double C) { return f (C, C); },
+                                   lo, hi, adaptiveTol, adaptiveMaxEvals);
+    }
+    std::cout << "Best C1: " << res.C1 << " C2: " << res.C2 << " after "
+              << res.evaluations << " cross validations\n";
+    cvAcc = balancedAcc[std::make_pair (res.C1, res.C2)];
+    setPosC (res.C1);
+    setNegC (res.C2);
+    priorC1 = res.C1;
+    priorC2 = res.C2;
+}
+
+/// Out-of-fold score of every training sample at Cp, Cn: each sample is
+/// scored by the model of the cross validation fold without it
+void SVMTestSuite::outOfFoldScores (double Cp, double Cn, vecD_t &scores)
+{
+    vec<size_t> rows (labels.size ());
+    for (size_t i = 0; i < rows.size (); i++)
+        rows[i] = i;
+    if (solver == DUAL_COORDINATE_DESCENT)
+    {
+        DCDSolver s;
+        s.setSampleWeights (sampleWeights ());
+        vec<vecD_t> alphas = foldAlpha;
+        double accPos, accNeg;
+        s.setPosC (Cp);
+        s.setNegC (Cn);
+        if (sparseRows)
+            dcdCrossValidate (s, trainSp, labels, rows, nfold, alphas,
+                              accPos, accNeg, &scores);
+        else
+            dcdCrossValidate (s, trainMat, labels, rows, nfold, alphas,
+                              accPos, accNeg, &scores);
+        return;
+    }
+    if (fixed)
+    {
+        fixed->outOfFoldScores (labels, Cp * posCWeight, Cn * negCWeight, nfold, scores);
+        return;
+    }
+    scores.assign (labels.size (), 0.0);
+    dlib::svm_c_linear_trainer<kernel_type> tr = trainer;
+    tr.set_c_class1 (Cp * posCWeight);
+    tr.set_c_class2 (Cn * negCWeight);
+    vec<size_t> trainRows, testRows;
+    for (uint k = 0; k < nfold; k++)
+    {
+        classFolds (labels, rows, nfold, k, trainRows, testRows);
+        vec<sample_type> s;
+        vec<label_t> l;
+        for (size_t i = 0; i < trainRows.size (); i++)
+        {
+            s.push_back (samples[trainRows[i]]);
+            l.push_back (labels[trainRows[i]]);
+        }
+        dec_funct_type df = tr.train (s, l);
+        for (size_t i = 0; i < testRows.size (); i++)
+            scores[testRows[i]] = df(samples[testRows[i]]);
+    }
+}
+
+/* Pick the decision threshold for [svm] TargetPrecision or TargetRecall from
+ * the all-threshold curve of the out-of-fold scores, so an operating point is
+ * chosen without retraining with other C1 / C2 weights. The threshold is used
+ * by classify and saved with incremental models.
+*/
+void SVMTestSuite::chooseThreshold ()
+{
+    if (targetPrecision <= 0 && targetRecall <= 0)
+        return;
+    vecD_t scores;
+    if (sparse && sparseOof.size () == labels.size ())
+        scores = sparseOof;
+    else
+        outOfFoldScores (C1, C2, scores);
+    RocCurve roc;
+    roc.compute (scores, labels, sampleWeights ());
+    if (targetPrecision > 0)
+        threshold = roc.thresholdForPrecision (targetPrecision);
+    else
+        threshold = roc.thresholdForRecall (targetRecall);
+    std::cout << "\nCross validation ROC AUC: " << roc.rocAuc ()
+              << "  PR AUC: " << roc.prAuc () << "\n"
+              << "Threshold for target " << ((targetPrecision > 0) ? "precision " : "recall ")
+              << ((targetPrecision > 0) ? targetPrecision : targetRecall)
+              << ": " << threshold << "\n";
+    *this << "\n- Decision threshold from cross validation:" << threshold;
+}
+
+/* Returns the fraction of correctly classified +1 and -1 samples of an
+ * nfold cross validation on the current training samples. The cache keeps
+ * them together with the accuracies of every fold (see runCrossValidate).
+*/
+dlib::matrix<double,1,2> SVMTestSuite::crossValidate (double Cp, double Cn)
+{
+    dlib::matrix<double,1,2> acc;
+    CVRecord r;
+    std::stringstream key;
+    key << std::setprecision (17) << cvKey << " Cp=" << Cp << " Cn=" << Cn;
+    if (cache.enabled () && cache.get (key.str (), r, "acc") && r["acc"].size () == 2)
+    {
+        acc(0) = r["acc"][0];
+        acc(1) = r["acc"][1];
+        return acc;
+    }
+    acc = runCrossValidate (Cp, Cn, r["folds"]);
+    r["acc"] = { acc(0), acc(1) };
+    cache.put (key.str (), r);
+    return acc;
+}
+
+/* crossValidate without the result cache, 'folds' receives the accuracies of
+ * every fold, fold k at 2k (+1 samples) and 2k + 1 (-1 samples).
+ *
+ * The folds are contiguous per class (see classFolds). For the dual
+ * coordinate descent solver see dcdCrossValidate, the dual variables of every
+ * fold are kept to warm start the fold for the next C. The dlib trainer
+ * scores every fold with the model trained on the others (outOfFoldScores).
+*/
+dlib::matrix<double,1,2> SVMTestSuite::runCrossValidate (double Cp, double Cn,
+                                                         vecD_t &folds)
+{
+    if (multiClass)
+        return crossValidateMultiClass (Cp, Cn, folds);
+    vec<size_t> rows (labels.size ());
+    for (size_t i = 0; i < rows.size (); i++)
+        rows[i] = i;
+    dlib::matrix<double,1,2> acc;
+    if (solver == DLIB_CUTTING_PLANE)
+    {
+        vecD_t scores;
+        outOfFoldScores (Cp, Cn, scores);
+        vecD_t tpos (nfold, 0.0), tneg (nfold, 0.0), cpos (nfold, 0.0), cneg (nfold, 0.0);
+        vec<size_t> trainRows, testRows;
+        for (uint k = 0; k < nfold; k++)
+        {
+            classFolds (labels, rows, nfold, k, trainRows, testRows);
+            for (size_t i = 0; i < testRows.size (); i++)
             {
-                eneg += 1;
-                *this << "\t" << "FP";
+                double w = sampleWeights () ? trainWeights[testRows[i]] : 1.0;
+                if (labels[testRows[i]] > 0)
+                {
+                    tpos[k] += w;
+                    cpos[k] += w * (scores[testRows[i]] >= 0);
+                }
+                else
+                {
+                    tneg[k] += w;
+                    cneg[k] += w * (scores[testRows[i]] < 0);
+                }
             }
         }
-        else if (l[k] > 0)
+        double cp = 0, cn = 0, tp = 0, tn = 0;
+        folds.resize (2 * nfold);
+        for (uint k = 0; k < nfold; k++)
+        {
+            folds[2 * k] = cpos[k] / tpos[k];
+            folds[2 * k + 1] = cneg[k] / tneg[k];
+            cp += cpos[k];
+            cn += cneg[k];
+            tp += tpos[k];
+            tn += tneg[k];
+        }
+        acc(0) = cp / tp;
+        acc(1) = cn / tn;
+        return acc;
+    }
+    double cpos, cneg;
+    dcd.setPosC (Cp);
+    dcd.setNegC (Cn);
+    if (sparseRows)
+        dcdCrossValidate (dcd, trainSp, labels, rows, nfold, foldAlpha, cpos, cneg,
+                          NULL, &folds);
+    else
+        dcdCrossValidate (dcd, trainMat, labels, rows, nfold, foldAlpha, cpos, cneg,
+                          NULL, &folds);
+    acc(0) = cpos;
+    acc(1) = cneg;
+    return acc;
+}
+
+/* Multi-class counterpart of crossValidate: class-wise contiguous folds over
+ * all classes, one-vs-rest models trained on the rows of the other folds,
+ * one task of the pool per fold. Both entries of the result hold the mean
+ * per-class accuracy (recall), so the selection rule of crossValidateBestC
+ * applies unchanged; so do both entries of every fold in 'folds'.
+*/
+dlib::matrix<double,1,2> SVMTestSuite::crossValidateMultiClass (double Cp, double Cn,
+                                                                vecD_t &folds)
+{
+    const size_t K = classes.size ();
+    vec<OneVsRestSVM> cv (nfold);
+    for (uint k = 0; k < nfold; k++)
+    {
+        cv[k].setClasses (classes);
+        cv[k].setSampleWeights (sampleWeights ());
+        cv[k].setPosC (Cp);
+        cv[k].setNegC (Cn);
+    }
+    vec<vec<size_t> > members (K);
+    for (size_t i = 0; i < labels.size (); i++)
+        if (cv[0].classIndex (labels[i]) < K)
+            members[cv[0].classIndex (labels[i])].push_back (i);
+    vec<vecD_t> foldCorrect (nfold, vecD_t (K, 0.0)), foldTotal (nfold, vecD_t (K, 0.0));
+    TaskPool::instance ().parallelFor ("multi-class cv fold", 0, nfold, 1, [&] (size_t k) {
+        vec<size_t> trainRows, testRows;
+        for (size_t c = 0; c < K; c++)
+        {
+            size_t cb = k * members[c].size () / nfold;
+            size_t ce = (k + 1) * members[c].size () / nfold;
+            for (size_t i = 0; i < members[c].size (); i++)
+                ((i >= cb && i < ce) ? testRows : trainRows).push_back (members[c][i]);
+        }
+        cv[k].train (trainMat, labels, trainRows);
+        FeatureMatrix X;
+        ScoreMatrix S;
+        X.set_size (testRows.size (), trainMat.cols ());
+        for (size_t i = 0; i < testRows.size (); i++)
+            std::copy (trainMat.row (testRows[i]),
+                       trainMat.row (testRows[i]) + trainMat.cols (), X.row (i));
+        cv[k].scores (X, S);
+        for (size_t i = 0; i < testRows.size (); i++)
+        {
+            size_t c = cv[k].classIndex (labels[testRows[i]]);
+            double w = sampleWeights () ? trainWeights[testRows[i]] : 1.0;
+            foldTotal[k][c] += w;
+            if (cv[k].argmax (S.row (i)) == labels[testRows[i]])
+                foldCorrect[k][c] += w;
+        }
+    });
+    folds.assign (2 * nfold, 0.0);
+    for (uint k = 0; k < nfold; k++)
+    {
+        for (size_t c = 0; c < K; c++)
+            folds[2 * k] += foldCorrect[k][c] / foldTotal[k][c] / K;
+        folds[2 * k + 1] = folds[2 * k];
+    }
+    vecD_t correct (K, 0.0);
+    for (uint k = 0; k < nfold; k++)
+        for (size_t c = 0; c < K; c++)
+            correct[c] += foldCorrect[k][c];
+    double mean_acc = 0;
+    for (size_t c = 0; c < K; c++)
+    {
+        double total = 0;
+        for (size_t i = 0; i < members[c].size (); i++)
+            total += sampleWeights () ? trainWeights[members[c][i]] : 1.0;
+        mean_acc += correct[c] / total / K;
+    }
+    dlib::matrix<double,1,2> acc;
+    acc(0) = mean_acc;
+    acc(1) = mean_acc;
+    return acc;
+}
+
+/// Fraction of correctly classified +1 and -1 samples, unlabelled (0) are skipped
+dlib::matrix<double,1,2> SVMTestSuite::accuracy (const dec_funct_type &f,
+                                                 const vec<sample_type> &s,
+                                                 const vec<label_t> &l)
+{
+    vecD_t scores (s.size ());
+    for (size_t k = 0; k < s.size (); k++)
+        scores[k] = f(s[k]);
+    return accuracy (scores, l);
+}
+
+dlib::matrix<double,1,2> SVMTestSuite::accuracy (const vecD_t &scores,
+                                                 const vec<label_t> &l)
+{
+    double cpos = 0, cneg = 0, tpos = 0, tneg = 0;
+    for (size_t k = 0; k < scores.size (); k++)
+    {
+        double p = scores[k];
+        if (l[k] > 0)
         {
             tpos += 1;
-            if (p < 0)
-            {
-                epos += 1;
-                *this << "\t" << "FN";
-            }
+            cpos += (p >= 0);
         }
-        else if (l[k] == 0)
+        else if (l[k] < 0)
         {
-            std::string mp4FileName = testSet[k].getComments ();
-            std::string jpgFileName = mp4FileName.substr(0, mp4FileName.find_first_of ('.')) + ".jpg";
-            if (p > 0)
+            tneg += 1;
+            cneg += (p < 0);
+        }
+    }
+    dlib::matrix<double,1,2> acc;
+    acc(0) = (tpos > 0) ? cpos / tpos : 0;
+    acc(1) = (tneg > 0) ? cneg / tneg : 0;
+    return acc;
+}
+
+/* Time-to-accuracy comparison of the dlib cutting plane trainer and the dual
+ * coordinate descent solver at the current C1/C2.
+ *
+ * Both solvers are run with a decreasing stopping tolerance. The tolerances
+ * of the two solvers are not comparable (dlib: risk gap, DCD: projected
+ * gradient gap), compare the rows by time and accuracy instead.
+*/
+void SVMTestSuite::benchmarkSolvers ()
+{
+    const double tol[] = {1.0, 0.1, 0.01, 0.001};
+    dlib::matrix<double,1,2> trainAcc, testAcc;
+    dec_funct_type df;
+    std::cout << "\n########## Solver benchmark ##########\n"
+              << "C1: " << C1 << "\tC2: " << C2 << "\n"
+              << std::setw(8) << "Solver" << std::setw(10) << "tol"
+              << std::setw(12) << "time (ms)" << std::setw(12) << "train +1"
+              << std::setw(12) << "train -1" << std::setw(12) << "test +1"
+              << std::setw(12) << "test -1" << "\n";
+    for (size_t t = 0; t < sizeof (tol) / sizeof (tol[0]); t++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+            if (k == 0)
             {
-                tpos += 1;
-                moveFile (mp4FileName, pathName, "", ing);
-                moveFile (jpgFileName, pathName, "", ing);
+                dlib::svm_c_linear_trainer<kernel_type> tr;
+                tr.set_c_class1 (C1 * posCWeight);
+                tr.set_c_class2 (C2 * negCWeight);
+                tr.set_epsilon (tol[t]);
+                df = tr.train (samples, labels);
             }
             else
             {
-                tneg += 1;
-                moveFile (mp4FileName, pathName, "", ning);
-                moveFile (jpgFileName, pathName, "", ning);
+                DCDSolver s;
+                s.setSampleWeights (sampleWeights ());
+                s.setPosC (C1);
+                s.setNegC (C2);
+                s.setEpsilon (tol[t]);
+                s.train (trainMat, labels);
+                df = linearToDlib (s.getWeights (), s.getBias ());
             }
+            double ms = std::chrono::duration<double, std::milli> (
+                        std::chrono::steady_clock::now () - start).count ();
+            trainAcc = accuracy (df, samples, labels);
+            testAcc = accuracy (df, testSamples, testLabels);
+            std::cout << std::fixed << std::setprecision (4)
+                      << std::setw(8) << ((k == 0) ? "dlib" : "dcd")
+                      << std::setw(10) << tol[t] << std::setw(12) << ms
+                      << std::setw(12) << trainAcc(0) << std::setw(12) << trainAcc(1)
+                      << std::setw(12) << testAcc(0) << std::setw(12) << testAcc(1) << "\n";
         }
     }
+}
+
+void SVMTestSuite::classify ()
+{
+    if (multiClass)
+    {
+        classifyMultiClass ();
+        return;
+    }
+    if (streamTest)
+    {
+        classifyStream ();
+        return;
+    }
+    vecD_t scores (testSamples.size ());
+    if (cascade && !quantized)
+        cascadeScores (scores);
+    else if (sparse)
+        sparseScores (scores);
+    else if (sparseRows)
+        sparseRowScores (scores);
+    else if (rawInput)
+        rawScores (scores);
+    else if (fixed)
+        fixed->testScores (scores);
+    else
+        for (size_t k = 0; k < testSamples.size (); k++)
+            scores[k] = learned_function(testSamples[k]);
+    if (quantized)
+        quantizedScores (scores);
+    classify (scores, testLabels, cascade && !quantized);
+}
+
+/// Hyperplane of the current (binary) model on normalized features
+void SVMTestSuite::hyperplane (vecD_t &w, double &bias) const
+{
+    if (fixed)
+        fixed->hyperplane (w, bias);
+    else
+        dlibToLinear (learned_function.function, w, bias);
+}
+
+/* Early-exit scores of the test set (see CascadeScorer), the full scores
+ * are never computed: only their side of the threshold is meaningful, so
+ * classify reports decisions instead of scores and no ROC curve. Logs the
+ * features visited per sample and whether the decisions are exact for every
+ * sample or for those in the training range.
+*/
+void SVMTestSuite::cascadeScores (vecD_t &scores)
+{
+    vecD_t w;
+    double bias;
+    hyperplane (w, bias);
+    CascadeScorer cs;
+    cs.setBlock (cascadeBlock);
+    if (rawInput)
+        cs.setInputNormalization (trainMean, trainPrec);
+    cs.build (w, bias, trainSet, features, dataClip);
+    size_t touched = cs.scores (testSet, threshold, scores);
+    double avg = touched / (double) std::max ((size_t) 1, testSet.size ());
+    std::cout << "- Cascaded scoring: " << avg << " of " << cs.dimension ()
+              << " features per sample, decisions "
+              << (cs.exact () ? "exact (clipped input)"
+                              : "exact for samples within the training range") << "\n";
+    *this << "\n- Cascaded scoring features per sample:" << avg
+          << "\n- Cascaded scoring exact for all samples:" << cs.exact ();
+}
+
+/* Hyperplane of the current model on raw features. The model scores
+ * normalized features z_j = (x_j - mu_j) prec_j, so
+ *
+ *      w' z + b = sum_j (w_j prec_j) x_j + (b - sum_j w_j prec_j mu_j)
+ *
+ * i.e. w'_j = w_j prec_j and b' = b - sum_j w'_j mu_j. The identity
+ * normalizer of learned_function (see initTrainer) drops out.
+*/
+void SVMTestSuite::foldedHyperplane (vecD_t &w, double &bias) const
+{
+    hyperplane (w, bias);
+    for (size_t j = 0; j < w.size (); j++)
+    {
+        w[j] *= trainPrec[features[j]];
+        bias -= w[j] * trainMean[features[j]];
+    }
+}
+
+/// Scores of the raw (never normalized or copied) test rows
+void SVMTestSuite::rawScores (vecD_t &scores) const
+{
+    vecD_t w;
+    double bias;
+    foldedHyperplane (w, bias);
+    scores.resize (testSet.size ());
+    TaskPool::instance ().parallelFor ("raw scores", 0, testSet.size (), 0, [&] (size_t i) {
+        const sample_t &x = testSet[i];
+        double f = bias;
+        for (size_t j = 0; j < w.size (); j++)
+            f += w[j] * x[features[j]];
+        scores[i] = f;
+    });
+}
+
+/* Train along the L1 / elastic-net regularization path (see L1PathSolver) on
+ * trainMat, C1 / C2 weighting the classes. The path is cross validated with
+ * the same lambdas, and the sparsest model whose balanced cross validation
+ * accuracy is within [svm] SparseTolerance of the best one is kept. Prints
+ * the sparsity / accuracy trade-off and the features the model does not
+ * use, which feature extraction can skip.
+*/
+void SVMTestSuite::trainSparse (const vec<label_t> &l)
+{
+    L1PathSolver s;
+    s.setPosC (C1);
+    s.setNegC (C2);
+    s.setL1Ratio (sparseL1Ratio);
+    s.setSampleWeights (sampleWeights ());
+    vec<size_t> rows (trainMat.rows ());
+    for (size_t i = 0; i < rows.size (); i++)
+        rows[i] = i;
+    s.setLambdas (L1PathSolver::makeLambdas (s.lambdaMax (trainMat, l, rows),
+                                             sparsePathLength, sparsePathRatio));
+    vec<PathPoint> path;
+    vecD_t accPos, accNeg;
+    vec<vecD_t> oof;
+    s.fitPath (trainMat, l, rows, path);
+    l1CrossValidatePath (s, trainMat, l, rows, nfold, accPos, accNeg, &oof);
+
+    double best = 0;
+    for (size_t p = 0; p < path.size (); p++)
+        best = std::max (best, 0.5 * (accPos[p] + accNeg[p]));
+    size_t chosen = 0;
+    while (0.5 * (accPos[chosen] + accNeg[chosen]) < best - sparseTol)
+        chosen++;
+    sparsePath.clear ();
+    for (size_t p = 0; p < path.size (); p++)
+    {
+        sparsePath.push_back (path[p].lambda);
+        sparsePath.push_back (path[p].active);
+        sparsePath.push_back (0.5 * (accPos[p] + accNeg[p]));
+    }
+    sparseChosen = chosen;
+
+    const PathPoint &m = path[chosen];
+    cvAcc = 0.5 * (accPos[chosen] + accNeg[chosen]);
+    sparseOof = oof[chosen];
+    sparseModel = SparseLinearModel (m.w, m.bias, features);
+    // The dense hyperplane serves the threshold choice, the cache and the
+    // incremental state
+    if (fixed)
+        fixed->setHyperplane (m.w, m.bias);
+    else
+        learned_function.function = linearToDlib (m.w, m.bias);
+    printSparseModel ();
+}
+
+/// Print the L1 path (sparsePath) and the features the chosen model uses
+/// and those feature extraction can skip
+void SVMTestSuite::printSparseModel ()
+{
+    std::streamsize precision = std::cout.precision ();
+    std::cout << "\n- L1 path (L1 ratio " << sparseL1Ratio << "):\n"
+              << "\tlambda\t\tactive\tcv accuracy\n";
+    for (size_t p = 0; 3 * p + 2 < sparsePath.size (); p++)
+        std::cout << "\t" << std::setprecision (4) << sparsePath[3 * p] << "\t\t"
+                  << (size_t) sparsePath[3 * p + 1] << "\t" << sparsePath[3 * p + 2]
+                  << (p == sparseChosen ? "\t<-" : "") << "\n";
+    std::cout.precision (precision);
+
+    // The columns of sparseModel are in the order of features
+    Str_t activeList, skipList, num;
+    size_t k = 0;
+    for (size_t j = 0; j < features.size (); j++)
+    {
+        bool active = k < sparseModel.active () && sparseModel.col[k] == features[j];
+        (active ? activeList : skipList) += stringify (features[j] + 1, num) + ",";
+        k += active;
+    }
+    double lambda = (3 * sparseChosen < sparsePath.size ()) ? sparsePath[3 * sparseChosen] : 0;
+    std::cout << "- Sparse model: " << sparseModel.active () << " of " << features.size ()
+              << " features active.\n- Active features: " << activeList
+              << "\n- Features extraction can skip: " << skipList << "\n";
+    *this << "\n- Sparse model lambda:" << lambda << "active features:" << sparseModel.active ()
+          << "\n- Active features: " << activeList
+          << "\n- Features extraction can skip: " << skipList;
+}
+
+/// Scores of the test set from the non-zero weights only
+void SVMTestSuite::sparseScores (vecD_t &scores) const
+{
+    SparseLinearModel m = rawInput ? sparseModel.folded (trainMean, trainPrec) : sparseModel;
+    scores.resize (testSet.size ());
+    TaskPool::instance ().parallelFor ("sparse scores", 0, testSet.size (), 0, [&] (size_t i) {
+        scores[i] = m.score (testSet[i]);
+    });
+}
+
+/// Scores of the sparse test rows, from their non-zeros only
+void SVMTestSuite::sparseRowScores (vecD_t &scores) const
+{
+    vecD_t w;
+    double bias;
+    hyperplane (w, bias);
+    scores.resize (testSp.rows ());
+    TaskPool::instance ().parallelFor ("sparse row scores", 0, testSp.rows (), 0, [&] (size_t i) {
+        scores[i] = bias + testSp.dot (i, w.data ());
+    });
+}
+
+/* Replace the double precision test scores by those of the int8 scoring
+ * path (see QuantizedScorer) and report how far they are from each other.
+*/
+void SVMTestSuite::quantizedScores (vecD_t &scores)
+{
+    vecD_t w, q;
+    double bias;
+    hyperplane (w, bias);
+    QuantizedScorer qs;
+    qs.setClip (quantizeClip);
+    qs.build (w, bias, trainSet, features);
+    if (rawInput)
+        qs.setInputNormalization (trainMean, trainPrec);
+    qs.quantize (testSet, features);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    qs.scores (q);
+    double ms = std::chrono::duration<double, std::milli> (
+                std::chrono::steady_clock::now () - start).count ();
+    double maxDev = 0;
+    size_t changed = 0;
+    for (size_t k = 0; k < q.size (); k++)
+    {
+        maxDev = std::max (maxDev, std::fabs (q[k] - scores[k]));
+        changed += ((q[k] > threshold) != (scores[k] > threshold));
+    }
+    std::cout << "- Int8 scoring (" << QuantizedScorer::kernelName () << "): "
+              << qs.bytes () << " bytes, " << ms << " ms, max score deviation "
+              << maxDev << ", decisions changed " << changed << " / " << q.size () << "\n";
+    *this << "\n- Int8 scoring max score deviation:" << maxDev
+          << "\n- Int8 scoring decisions changed:" << changed;
+    scores.swap (q);
+}
+
+/* Multi-class counterpart of classify. All K scores of every test sample are
+ * computed in one pass, the prediction is the class with the largest score.
+ * Reports the confusion matrix (rows: original, columns: prediction).
+ * Unlabelled samples (label 0) are moved into the folder 'grade_<class>'.
+*/
+void SVMTestSuite::classifyMultiClass ()
+{
+    assert (testMat.rows () > 0 ||
+            !(std::cout << "Test set size 0. Run setTestMode first.\n"));
+    *this << "\n#####################" << "\nStarting classification:"
+          << "\n#####################";
+    *this << "\n---------------------------------------------------------------------------------------------------------------";
+    *this << "\nSr #\t\t|\t\t" << "Prediction" << "\t|\t" << "Original"
+          << "\t|\t\t" << "Comments";
+    *this << "\n---------------------------------------------------------------------------------------------------------------";
+    const size_t K = classes.size ();
+    vec<vec<size_t> > confusion (K, vec<size_t> (K, 0));
+    ScoreMatrix S;
+    if (rawInput)
+    {
+        OneVsRestSVM folded = ovr;
+        folded.foldNormalization (trainMean, trainPrec, features);
+        folded.scores (testMat, S);
+    }
+    else
+        ovr.scores (testMat, S);
+    Str_t grade;
+    for (size_t k = 0; k < testMat.rows (); k++)
+    {
+        label_t p = ovr.argmax (S.row (k));
+        label_t l = testLabels[k];
+        Str_t mp4FileName = testSet[k].getComments ();
+        *this << "\n#" << k+1 << "\t\t|\t\t" << p << "\t\t:\t\t" << l
+              << "\t\t|\t\t" << mp4FileName;
+        if (l == 0)
+        {
+            std::string jpgFileName = mp4FileName.substr(0, mp4FileName.find_first_of ('.')) + ".jpg";
+            grade = "grade_" + stringify (p, grade);
+            moveFile (mp4FileName, pathName, "", grade);
+            moveFile (jpgFileName, pathName, "", grade);
+        }
+        else if (ovr.classIndex (l) < K)
+        {
+            confusion[ovr.classIndex (l)][ovr.classIndex (p)]++;
+            if (p != l)
+                *this << "\t" << "ERR";
+        }
+    }
+    *this << "\nConfusion matrix (rows: original, columns: prediction):\n\t";
+    std::cout << "\nConfusion matrix (rows: original, columns: prediction):\n"
+              << std::setw(8) << " ";
+    for (size_t c = 0; c < K; c++)
+    {
+        *this << classes[c] << "\t";
+        std::cout << std::setw(8) << classes[c];
+    }
+    for (size_t r = 0; r < K; r++)
+    {
+        *this << "\n" << classes[r] << "\t";
+        std::cout << "\n" << std::setw(8) << classes[r];
+        for (size_t c = 0; c < K; c++)
+        {
+            *this << confusion[r][c] << "\t";
+            std::cout << std::setw(8) << confusion[r][c];
+        }
+    }
+    std::cout << "\n";
+    printf ("Done.\n");
+}
+
+void SVMTestSuite::classify (const vec<sample_type> &s, const vec<label_t> &l)
+{
+    vecD_t scores (s.size ());
+    for (size_t k = 0; k < s.size (); k++)
+        scores[k] = learned_function(s[k]);
+    classify (scores, l);
+}
+
+/// Report the classification of the test samples with the given scores,
+/// 'partial' for early-exit scores (see cascadeScores)
+void SVMTestSuite::classify (const vecD_t &scores, const vec<label_t> &l, bool partial)
+{
+    assert ((scores.size () > 0 && l.size () > 0) ||
+            !(std::cout << "Test set size 0. Run setTestMode first.\n"));
+    ClassifyCounts c;
+    classifyHeader ();
+    for (size_t k = 0; k < scores.size (); k++)
+        classifyRow (k, scores[k], l[k], testSet[k].getComments (), c, partial);
+    classifySummary (scores, l, c, partial);
+}
+
+void SVMTestSuite::classifyHeader ()
+{
+    *this << "\n#####################" << "\nStarting classification:"
+          << "\n#####################";
+    *this << "\n---------------------------------------------------------------------------------------------------------------";
+    *this << "\nSr #\t\t|\t\t" << "Prediction" << "\t|\t" << "Original"
+          << "\t|\t\t" << "Comments";
+    *this << "\n---------------------------------------------------------------------------------------------------------------";
+}
+
+/// Log and count test sample 'k', move it if it is unlabelled. A 'partial'
+/// score is logged as its decision (+1 / -1), its value is meaningless.
+void SVMTestSuite::classifyRow (size_t k, double score, label_t l,
+                                const Str_t &mp4FileName, ClassifyCounts &c, bool partial)
+{
+    Str_t ing = "interesting";
+    Str_t ning = "not_interesting";
+    label_t p = score;
+    *this << "\n#" << k+1 << "\t\t|\t\t";
+    if (partial)
+        *this << ((p > threshold) ? 1 : -1);
+    else
+        *this << ((int) (p * 10000)) / 100000.0 + 0.000011;
+    *this << "\t\t:\t\t" << l << "\t\t|\t\t" << mp4FileName;
+    if (l < 0)
+    {
+        c.tneg += 1;
+        if (p > threshold)
+        {
+            c.eneg += 1;
+            *this << "\t" << "FP";
+        }
+    }
+    else if (l > 0)
+    {
+        c.tpos += 1;
+        if (p < threshold)
+        {
+            c.epos += 1;
+            *this << "\t" << "FN";
+        }
+    }
+    else if (l == 0)
+    {
+        std::string jpgFileName = mp4FileName.substr(0, mp4FileName.find_first_of ('.')) + ".jpg";
+        if (p > threshold)
+        {
+            c.tpos += 1;
+            moveFile (mp4FileName, pathName, "", ing);
+            moveFile (jpgFileName, pathName, "", ing);
+        }
+        else
+        {
+            c.tneg += 1;
+            moveFile (mp4FileName, pathName, "", ning);
+            moveFile (jpgFileName, pathName, "", ning);
+        }
+    }
+}
+
+void SVMTestSuite::classifySummary (const vecD_t &scores, const vec<label_t> &l,
+                                    const ClassifyCounts &c, bool partial)
+{
+    float epos = c.epos, eneg = c.eneg, tpos = c.tpos, tneg = c.tneg;
     *this << "\n% of correctly classified +1 class: " << 1.0 - epos / tpos
           << "\n% of correctly classified -1 class: " << 1.0 - eneg / tneg;
 
@@ -316,9 +2014,146 @@ void SVMTestSuite::classify (const vec<sample_type> &s, const vec<label_t> &l)
               << std::setw(5) << epos / tpos << "\n";
     std::cout << "FN/N : " << std::setprecision (3)
               << std::setw(5) << eneg / tneg << "\n";
+    if (partial)
+    {
+        // Early-exit scores rank nothing, only their decisions are exact
+        std::cout << "Threshold: " << threshold
+                  << "  ROC / PR AUC: not computed (cascaded scores)\n";
+        *this << "\nThreshold:" << threshold
+              << "\nROC AUC: not computed, cascaded scores are partial";
+        printf ("Done.\n");
+        return;
+    }
+    RocCurve roc;
+    roc.compute (scores, l);
+    if (roc.points ().size () > 1)
+    {
+        std::cout << "Threshold: " << threshold << "  ROC AUC: " << roc.rocAuc ()
+                  << "  PR AUC: " << roc.prAuc () << "\n";
+        *this << "\nThreshold:" << threshold << "\nROC AUC:" << roc.rocAuc ()
+              << "\nPR AUC:" << roc.prAuc ();
+        if (writePred)
+        {
+            logP << "\n";
+            roc.print (logP, 50);
+        }
+    }
     printf ("Done.\n");
 }
 
+/// Reservoir loader without streaming: read the rows not sampled for
+/// training into testSet, one batch at a time
+void SVMTestSuite::materializeTestSet ()
+{
+    testSet.clear ();
+    DataHandler::streamRows (featureName, sampledRows, trainMean, trainPrec, streamBatch,
+                             [&] (const vecS_t &rows, const Str_t &comments) {
+        uint64_t base = CommentArena::instance ().append (comments);
+        for (size_t i = 0; i < rows.size (); i++)
+        {
+            testSet.push_back (rows[i]);
+            testSet.back ().setComment (base + rows[i].commentOff, rows[i].commentLen);
+        }
+    });
+    printf ("- Number of samples in testing set: %lu\n", testSet.size ());
+}
+
+/* Streaming counterpart of classify (reservoir loader with [data]
+ * StreamTest): the rows not sampled for training are read again in batches,
+ * scored (cascaded, int8 or float as in classify) and reported, and dropped.
+ * Only the scores and labels are kept for the ROC curve, O(n) but about a
+ * dozen bytes per row instead of a row (none with Cascade, whose partial
+ * scores have no curve).
+*/
+void SVMTestSuite::classifyStream ()
+{
+    vecD_t w, all;
+    vec<label_t> labels_;
+    double bias;
+    if (rawInput)
+        foldedHyperplane (w, bias);
+    else
+        hyperplane (w, bias);
+    SparseLinearModel sm (w, bias, features);
+    if (sparse)
+        sm = rawInput ? sparseModel.folded (trainMean, trainPrec) : sparseModel;
+    const bool partial = cascade && !quantized;
+    vecD_t wn;
+    double bn;
+    hyperplane (wn, bn);
+    CascadeScorer cs;
+    size_t touched = 0;
+    if (partial)
+    {
+        cs.setBlock (cascadeBlock);
+        if (rawInput)
+            cs.setInputNormalization (trainMean, trainPrec);
+        cs.build (wn, bn, trainSet, features, dataClip);
+    }
+    QuantizedScorer qs;
+    double maxDev = 0, ms = 0;
+    size_t changed = 0;
+    if (quantized)
+    {
+        qs.setClip (quantizeClip);
+        qs.build (wn, bn, trainSet, features);
+        if (rawInput)
+            qs.setInputNormalization (trainMean, trainPrec);
+    }
+    ClassifyCounts c;
+    size_t k = 0;
+    classifyHeader ();
+    size_t n = DataHandler::streamRows (featureName, sampledRows, trainMean, trainPrec,
+                                        streamBatch,
+                                        [&] (const vecS_t &rows, const Str_t &comments) {
+        vecD_t s (rows.size ());
+        if (partial)
+            touched += cs.scores (rows, threshold, s);
+        else
+            TaskPool::instance ().parallelFor ("stream scores", 0, rows.size (), 0, [&] (size_t i) {
+                s[i] = sm.score (rows[i]);
+            });
+        if (quantized)
+        {
+            vecD_t q;
+            qs.quantize (rows, features);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+            qs.scores (q);
+            ms += std::chrono::duration<double, std::milli> (
+                  std::chrono::steady_clock::now () - start).count ();
+            for (size_t i = 0; i < q.size (); i++)
+            {
+                maxDev = std::max (maxDev, std::fabs (q[i] - s[i]));
+                changed += ((q[i] > threshold) != (s[i] > threshold));
+            }
+            s.swap (q);
+        }
+        for (size_t i = 0; i < rows.size (); i++, k++)
+        {
+            classifyRow (k, s[i], rows[i].getLabel (),
+                         comments.substr (rows[i].commentOff, rows[i].commentLen), c, partial);
+            if (partial)
+                continue;
+            all.push_back (s[i]);
+            labels_.push_back (rows[i].getLabel ());
+        }
+    });
+    std::cout << "- Streamed " << n << " test rows in batches of " << streamBatch;
+    if (partial)
+        std::cout << ", cascade: " << touched / (double) std::max ((size_t) 1, n)
+                  << " of " << cs.dimension () << " features per sample";
+    std::cout << "\n";
+    if (quantized)
+    {
+        std::cout << "- Int8 scoring (" << QuantizedScorer::kernelName () << "): "
+                  << ms << " ms, max score deviation " << maxDev
+                  << ", decisions changed " << changed << " / " << n << "\n";
+        *this << "\n- Int8 scoring max score deviation:" << maxDev
+              << "\n- Int8 scoring decisions changed:" << changed;
+    }
+    classifySummary (all, labels_, c, partial);
+}
+
 void moveFile (const Str_t &f, const Str_t p, const Str_t &s, const Str_t &d)
 {
     std::stringstream com;
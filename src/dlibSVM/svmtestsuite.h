@@ -11,10 +11,25 @@
 #include <iomanip>
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
+#include <thread>
 #include <dlib/svm/cross_validate_assignment_trainer.h>
 #include <dlib/svm/svm_c_linear_trainer.h>
 #include <sys/stat.h>
 #include "datahandler.h"
+#include "dataconverter.h"
+#include "dcdsolver.h"
+#include "multiclass.h"
+#include "incrementalstate.h"
+#include "adaptivesearch.h"
+#include "roccurve.h"
+#include "gramcache.h"
+#include "fixeddim.h"
+#include "quantize.h"
+#include "cvcache.h"
+#include "cascade.h"
+#include "distributed.h"
+#include "l1path.h"
 #include "INIReader.h"
 
 
@@ -39,6 +54,27 @@ typedef enum testMode {
     CUSTOM
 } TESTMODE_t;
 
+typedef enum solverType {
+    DLIB_CUTTING_PLANE,
+    DUAL_COORDINATE_DESCENT
+} SOLVER_t;
+
+typedef enum searchType {
+    GRID_SEARCH,
+    SUCCESSIVE_HALVING,
+    ADAPTIVE_SEARCH
+} SEARCH_t;
+
+/// Running error counts of classify
+struct ClassifyCounts
+{
+    ClassifyCounts () : epos(0), eneg(0), tpos(0), tneg(0) {}
+    float epos;
+    float eneg;
+    float tpos;
+    float tneg;
+};
+
 class SVMTestSuite
 {
 public:
@@ -49,6 +85,8 @@ public:
     void load (const Str_t &train_file, const Str_t &test_file);
     void load (const Str_t &feature_file, uint num_train_samp);
     void load (const Str_t &feature_file, double train_ratio);
+    bool loadIncremental (const Str_t &feature_file, const Str_t &state_file);
+    void saveState ();
     ~SVMTestSuite()
     {
         if (writePred)
@@ -63,6 +101,7 @@ public:
     void noOutput () { writePred = false; }
     void classify ();
     void classify (const vec<sample_type> &s, const vec<label_t> &l);
+    void classifyMultiClass ();
     SVMTestSuite& operator<< (const std::string &s);
     SVMTestSuite& operator<< (const double &s);
     SVMTestSuite& operator<< (const int &s);
@@ -70,6 +109,13 @@ public:
     void setC (double C_);
     void setNegC (double C_);
     void setPosC (double C_);
+    void setSolver (SOLVER_t s) { solver = s; }
+    void setSearch (SEARCH_t s) { search = s; }
+    void setThreshold (double t) { threshold = configThreshold = t; }
+    void benchmarkSolvers ();
+    uint screenTop () const { return screenN; }
+    uint featureCount () const { return numFeat; }
+    vec<size_t> screenSubsets (const vec<vec<size_t> > &subsets);
 
     std::ofstream logP;
 
@@ -78,29 +124,151 @@ private:
     void dataHandlerToDlib (const vec<sample_t> &h, vec<sample_type> &s,
                             vec<label_t> &l, const vec<size_t> &f);
     void crossValidateBestC ();
+    void successiveHalving ();
+    void adaptiveSearchC ();
+    void outOfFoldScores (double Cp, double Cn, vecD_t &scores);
+    void chooseThreshold ();
+    dlib::matrix<double,1,2> crossValidate (double Cp, double Cn);
+    dlib::matrix<double,1,2> runCrossValidate (double Cp, double Cn, vecD_t &folds);
+    Str_t resultKey () const;
+    bool cachedResult (const Str_t &key);
+    void storeResult (const Str_t &key);
+    dlib::matrix<double,1,2> crossValidateMultiClass (double Cp, double Cn,
+                                                      vecD_t &folds);
+    dlib::matrix<double,1,2> accuracy (const dec_funct_type &f,
+                                       const vec<sample_type> &s,
+                                       const vec<label_t> &l);
+    dlib::matrix<double,1,2> accuracy (const vecD_t &scores,
+                                       const vec<label_t> &l);
+    void classify (const vecD_t &scores, const vec<label_t> &l, bool partial = false);
+    void classifyHeader ();
+    void classifyRow (size_t k, double score, label_t l, const Str_t &mp4FileName,
+                      ClassifyCounts &c, bool partial);
+    void classifySummary (const vecD_t &scores, const vec<label_t> &l,
+                          const ClassifyCounts &c, bool partial);
+    void classifyStream ();
+    void materializeTestSet ();
+    void quantizedScores (vecD_t &scores);
+    void hyperplane (vecD_t &w, double &bias) const;
+    void cascadeScores (vecD_t &scores);
+    void foldedHyperplane (vecD_t &w, double &bias) const;
+    void rawScores (vecD_t &scores) const;
+    void trainSparse (const vec<label_t> &l);
+    void printSparseModel ();
+    void sparseScores (vecD_t &scores) const;
+    void sparseRowScores (vecD_t &scores) const;
+    const vecD_t * sampleWeights () const
+    { return trainWeights.empty () ? NULL : &trainWeights; }
+    void readConfig ();
     void initTrainer ();
+    void startWorkers (const Str_t &train_file);
+    void sparseRowsOnly ();
+    void mineHardExamples ();
+    void prepareIncremental (const Str_t &key);
+    void recordIncremental (const Str_t &key);
 
     vecS_t trainSet;
     vecS_t testSet;
-    vecF_t trainMean;
-    vecF_t trainPrec;
+    vecS_t poolSet;
+    vecD_t trainMean;
+    vecD_t trainPrec;
     vec<sample_type> samples, testSamples;
     vec<label_t> labels, testLabels;
     funct_type learned_function;
     dlib::svm_c_linear_trainer<kernel_type> trainer;
+    std::unique_ptr<FixedDimModel> fixed;
+    DCDSolver dcd;
+    FeatureMatrix trainMat;
+    FeatureMatrix testMat;
+    SparseFeatureMatrix trainSp;    // sparse hashed rows, see sparseRows
+    SparseFeatureMatrix testSp;
+    OneVsRestSVM ovr;
+    vec<label_t> classes;
+    vec<vecD_t> foldAlpha;
+    vecD_t warmAlpha;
+    IncrementalState incState;
+    vecS_t rawTrainSet;
+    RunningMoments newMoments;
+    FeatureQuantiles newQuantiles;
+    vecD_t stateMean;
+    vecD_t statePrec;
+    std::streamoff newOffset;
+    size_t numRetained;
+    double driftTol;
+    double cvAcc;
+    SOLVER_t solver;
+    SEARCH_t search;
+    double halvingEta;
+    double halvingMinFraction;
+    double adaptiveTol;
+    uint adaptiveMaxEvals;
+    bool perClassC;
+    double priorC1;
+    double priorC2;
+    double threshold;
+    double configThreshold;
+    double targetPrecision;
+    double targetRecall;
+    GramCache gram;
+    uint screenN;
+    double screenLambda;
     uint nfold;
     uint numFeat;
     Str_t trainName;
     Str_t testName;
     Str_t featureName;
+    Str_t stateName;
     double trainRatio;
     double C1;
     double C2;
     bool writePred;
     bool separateTrainTestDat;
+    bool benchmark;
+    bool multiClass;
+    bool incremental;
+    bool fixedDim;
+    bool quantized;
+    bool dedup;
+    double posCWeight;
+    double negCWeight;
+    bool rawInput;
+    double dataClip;
+    bool cascade;
+    uint cascadeBlock;
+    bool reservoir;
+    bool streamTest;
+    size_t streamBatch;
+    vec<uint64_t> sampledRows;
+    bool robustScaling;
+    bool sparseRows;
+    bool sparse;
+    double sparseL1Ratio;
+    uint sparsePathLength;
+    double sparsePathRatio;
+    double sparseTol;
+    vecD_t sparseOof;
+    SparseLinearModel sparseModel;  // chosen model of the L1 path
+    vecD_t sparsePath;              // lambda, active features, cv accuracy per point
+    size_t sparseChosen;
+    DistributedSVM dist;
+    uint distWorkers;
+    CVCache cache;
+    Str_t cacheDir;
+    Str_t cvKey;
+    uint64_t dataHash;
+    bool mining;
+    uint miningRounds;
+    FeatureMatrix poolMat;
+    vec<label_t> poolLabels;
+    vecD_t trainWeights;
+    double quantizeClip;
+    vec<size_t> features;
     std::string pathName;
 };
 
+dec_funct_type linearToDlib (const vecD_t &w, double bias);
+void dlibToLinear (const dec_funct_type &df, vecD_t &w, double &bias);
+
 void moveFile (const Str_t &f, const Str_t p, const Str_t &s, const Str_t &d);
 inline bool fileExists (const std::string& name) {
   struct stat buffer;
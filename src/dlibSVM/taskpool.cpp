@@ -0,0 +1,292 @@
+#include "taskpool.h"
+#include <algorithm>
+#include <cstdio>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+/// Index of the queue of the calling thread, 0 outside the pool
+static thread_local size_t queueIndex = 0;
+
+static double seconds (Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double> (b - a).count ();
+}
+
+/// Pin the calling thread to 'cpu' (modulo the number of CPUs)
+static void pin (size_t cpu)
+{
+#ifdef __linux__
+    unsigned int n = std::max (1u, std::thread::hardware_concurrency ());
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (cpu % n, &set);
+    pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+#endif
+}
+
+/// Allow the calling thread on every CPU again, e.g. in a thread started by
+/// a pinned worker
+void TaskPool::unpin ()
+{
+#ifdef __linux__
+    unsigned int n = std::max (1u, std::thread::hardware_concurrency ());
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (unsigned int i = 0; i < n && i < CPU_SETSIZE; i++)
+        CPU_SET (i, &set);
+    pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+#endif
+}
+
+TaskPool & TaskPool::instance ()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+TaskPool::TaskPool () :
+    queued(0),
+    quit(false),
+    affinity(false),
+    collect(false),
+    steals(0),
+    maxQueued(0)
+{
+    start (std::max (1u, std::thread::hardware_concurrency ()));
+}
+
+TaskPool::~TaskPool ()
+{
+    stop ();
+}
+
+/// 'threads' (0: one per CPU) including the calling thread, the workers
+/// pinned to one CPU each with 'affinity_' (the caller is left alone);
+/// 'stats' collects the statistics of printStats. Must not be called while
+/// tasks are running.
+void TaskPool::configure (unsigned int threads, bool affinity_, bool stats)
+{
+    if (threads == 0)
+        threads = std::max (1u, std::thread::hardware_concurrency ());
+    collect = stats;
+    if (threads == this->threads () && affinity_ == affinity)
+        return;
+    stop ();
+    affinity = affinity_;
+    start (threads);
+}
+
+void TaskPool::start (unsigned int threads)
+{
+    quit = false;
+    queues.push_back (new Queue ());
+    for (size_t i = 1; i < threads; i++)
+        queues.push_back (new Queue ());
+    for (size_t i = 1; i < threads; i++)
+        workers.push_back (std::thread (&TaskPool::workerLoop, this, i));
+}
+
+void TaskPool::stop ()
+{
+    {
+        std::lock_guard<std::mutex> lock (sleepMutex);
+        quit = true;
+    }
+    wake.notify_all ();
+    for (size_t i = 0; i < workers.size (); i++)
+        workers[i].join ();
+    workers.clear ();
+    for (size_t i = 0; i < queues.size (); i++)
+        delete queues[i];
+    queues.clear ();
+}
+
+void TaskPool::workerLoop (size_t id)
+{
+    queueIndex = id;
+    if (affinity)
+        pin (id);
+    Task t;
+    while (true)
+    {
+        if (take (id, t))
+        {
+            run (t);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock (sleepMutex);
+        wake.wait (lock, [this] { return quit || queued > 0; });
+        if (quit)
+            return;
+    }
+}
+
+/// Own queue from the back, then the others from the front
+bool TaskPool::take (size_t self, Task &t)
+{
+    {
+        Queue &own = *queues[self];
+        std::lock_guard<std::mutex> lock (own.m);
+        if (!own.q.empty ())
+        {
+            t = std::move (own.q.back ());
+            own.q.pop_back ();
+            queued--;
+            return true;
+        }
+    }
+    for (size_t k = 1; k < queues.size (); k++)
+    {
+        Queue &other = *queues[(self + k) % queues.size ()];
+        std::lock_guard<std::mutex> lock (other.m);
+        if (!other.q.empty ())
+        {
+            t = std::move (other.q.front ());
+            other.q.pop_front ();
+            queued--;
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::run (Task &t)
+{
+    Clock::time_point a = Clock::now ();
+    try
+    {
+        t.fn ();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock (t.group->m);
+        if (!t.group->error)
+            t.group->error = std::current_exception ();
+    }
+    if (collect)
+        record (t.name, seconds (a, Clock::now ()), true);
+    // The group may be gone as soon as its count is 0, the waiter is woken
+    // through the pool
+    if (--t.group->pending == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock (sleepMutex);
+        }
+        wake.notify_all ();
+    }
+}
+
+void TaskPool::spawn (TaskGroup &g, const char *name, const std::function<void ()> &fn)
+{
+    g.pending++;
+    Task t;
+    t.fn = fn;
+    t.group = &g;
+    t.name = name;
+    // Counted before it is visible, so 'queued' never drops below zero
+    size_t depth = ++queued;
+    {
+        Queue &own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock (own.m);
+        own.q.push_back (std::move (t));
+    }
+    size_t m = maxQueued;
+    while (depth > m && !maxQueued.compare_exchange_weak (m, depth))
+        ;
+    {
+        std::lock_guard<std::mutex> lock (sleepMutex);
+    }
+    wake.notify_one ();
+}
+
+/// Run queued tasks (of any group) until all tasks of 'g' are done, sleep
+/// while there is nothing to run. Rethrows the first exception of a task.
+void TaskPool::wait (TaskGroup &g)
+{
+    Task t;
+    while (g.pending > 0)
+    {
+        if (take (queueIndex, t))
+        {
+            run (t);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock (sleepMutex);
+        wake.wait (lock, [&] { return g.pending == 0 || queued > 0; });
+    }
+    if (g.error)
+    {
+        std::exception_ptr e = g.error;
+        g.error = std::exception_ptr ();
+        std::rethrow_exception (e);
+    }
+}
+
+/* fn (i) for every i in [begin, end), in tasks of 'grain' consecutive
+ * indices (0: about four tasks per thread), returns when all are done.
+*/
+void TaskPool::parallelFor (const char *name, size_t begin, size_t end, size_t grain,
+                            const std::function<void (size_t)> &fn)
+{
+    if (end <= begin)
+        return;
+    Clock::time_point a = Clock::now ();
+    size_t n = end - begin;
+    if (grain == 0)
+        grain = std::max ((size_t) 1, n / (4 * threads ()));
+    if (n <= grain || threads () == 1)
+    {
+        for (size_t i = begin; i < end; i++)
+            fn (i);
+    }
+    else
+    {
+        TaskGroup g;
+        for (size_t b = begin; b < end; b += grain)
+        {
+            size_t e = std::min (end, b + grain);
+            spawn (g, name, [&fn, b, e] { for (size_t i = b; i < e; i++) fn (i); });
+        }
+        wait (g);
+    }
+    if (collect)
+        record (name, seconds (a, Clock::now ()), false);
+}
+
+void TaskPool::record (const char *name, double s, bool task)
+{
+    std::lock_guard<std::mutex> lock (statsMutex);
+    Stats &st = stats[name];
+    if (task)
+    {
+        st.tasks++;
+        st.busy += s;
+        st.maxTask = std::max (st.maxTask, s);
+    }
+    else
+    {
+        st.calls++;
+        st.wall += s;
+    }
+}
+
+void TaskPool::printStats () const
+{
+    if (!collect)
+        return;
+    std::lock_guard<std::mutex> lock (statsMutex);
+    printf ("\nTask pool: %u threads, %lu steals, max queue depth %lu\n",
+            threads (), (unsigned long) steals, (unsigned long) maxQueued);
+    printf ("%-24s %8s %8s %10s %10s %10s\n", "task", "calls", "tasks",
+            "wall (s)", "busy (s)", "max (ms)");
+    std::map<Str_t, Stats>::const_iterator it;
+    for (it = stats.begin (); it != stats.end (); ++it)
+        printf ("%-24s %8lu %8lu %10.3f %10.3f %10.3f\n", it->first.c_str (),
+                (unsigned long) it->second.calls, (unsigned long) it->second.tasks,
+                it->second.wall, it->second.busy, 1e3 * it->second.maxTask);
+}
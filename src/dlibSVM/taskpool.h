@@ -0,0 +1,120 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+
+typedef std::string Str_t;
+
+/// Set of tasks that can be waited for together, see TaskPool::spawn.
+/// The first exception thrown by one of its tasks is rethrown by wait.
+struct TaskGroup
+{
+    TaskGroup () : pending(0) {}
+    std::atomic<size_t> pending;
+    std::mutex m;
+    std::exception_ptr error;
+};
+
+/* Process-wide work-stealing task pool shared by every parallel stage
+ *
+ * Every worker owns a deque: tasks it spawns go to the back of its own
+ * deque and it runs them LIFO (cache warm, depth first), idle workers steal
+ * from the front of the other deques (oldest, biggest tasks first). Threads
+ * outside the pool (the main thread) push to a shared entry deque.
+ *
+ * wait and parallelFor run queued tasks until the group is done and only
+ * sleep (on a condition variable) when there is nothing left to run. Nested
+ * parallelism (e.g. parallel shards, each with a parallel loop, or parallel
+ * candidates, each cross validating its folds in parallel) therefore shares
+ * the same threads instead of multiplying them, and cannot deadlock. Tasks
+ * must not block on anything but the pool. An exception thrown by a task is
+ * caught by the thread running it and rethrown by wait of its group.
+ *
+ * Affinity pins the workers to CPUs 1, 2, ... (modulo the number of CPUs),
+ * never the calling thread: threads and processes it starts later (readers,
+ * Shogun, distributed workers) keep the full CPU set.
+ *
+ * Statistics per task name (a string literal): number of tasks, summed and
+ * maximum task time, wall time of the parallel calls, steals and the deepest
+ * total queue.
+ *
+ * Usage:
+ *      TaskPool &pool = TaskPool::instance ();
+ *      pool.configure (threads, affinity, stats);
+ *      pool.parallelFor ("normalize", 0, n, 0, [&] (size_t i) { ... });
+ *      TaskGroup g;
+ *      pool.spawn (g, "read test", [&] { ... });
+ *      ...
+ *      pool.wait (g);
+*/
+class TaskPool
+{
+public:
+    static TaskPool & instance ();
+    ~TaskPool ();
+    void configure (unsigned int threads, bool affinity, bool stats);
+    unsigned int threads () const { return (unsigned int) workers.size () + 1; }
+    void spawn (TaskGroup &g, const char *name, const std::function<void ()> &fn);
+    void wait (TaskGroup &g);
+    void parallelFor (const char *name, size_t begin, size_t end, size_t grain,
+                      const std::function<void (size_t)> &fn);
+    void printStats () const;
+    static void unpin ();
+
+private:
+    struct Task
+    {
+        std::function<void ()> fn;
+        TaskGroup *group;
+        const char *name;
+    };
+    struct Queue
+    {
+        std::mutex m;
+        std::deque<Task> q;
+    };
+    struct Stats
+    {
+        Stats () : tasks(0), busy(0), maxTask(0), wall(0), calls(0) {}
+        size_t tasks;
+        double busy;
+        double maxTask;
+        double wall;
+        size_t calls;
+    };
+
+    TaskPool ();
+    void start (unsigned int threads);
+    void stop ();
+    void workerLoop (size_t id);
+    bool take (size_t self, Task &t);
+    void run (Task &t);
+    void record (const char *name, double seconds, bool task);
+
+    std::vector<std::thread> workers;
+    std::vector<Queue *> queues;        // 0: entry queue, 1..: workers
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued;
+    std::atomic<bool> quit;
+    bool affinity;
+    bool collect;
+    mutable std::mutex statsMutex;
+    std::map<Str_t, Stats> stats;
+    std::atomic<size_t> steals;
+    std::atomic<size_t> maxQueued;
+};
+
+#endif // TASKPOOL_H
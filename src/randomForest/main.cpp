@@ -1,10 +1,21 @@
 #include <shogun/labels/BinaryLabels.h>
+#include <shogun/labels/MulticlassLabels.h>
 #include <shogun/features/DenseFeatures.h>
 #include <shogun/kernel/GaussianKernel.h>
 #include <shogun/classifier/svm/LibSVM.h>
+#include <shogun/classifier/svm/LibLinear.h>
+#include <shogun/machine/RandomForest.h>
+#include <shogun/ensemble/MajorityVote.h>
 #include <shogun/base/init.h>
 #include <shogun/lib/common.h>
 #include <shogun/io/SGIO.h>
+#include <shogun/base/Parallel.h>
+#include <dlib/svm.h>
+#include <chrono>
+#include <algorithm>
+#include "dlibSVM/datahandler.h"
+#include "dlibSVM/shogunconverter.h"
+#include "dlibSVM/dcdsolver.h"
 
 using namespace shogun;
 
@@ -15,10 +26,269 @@ void print_message(FILE* target, const char* str)
 
 int test_random_forest (int argc, char **argv);
 int test_svm (int argc, char **argv);
+int test_svm_file (int argc, char **argv);
+int compare_linear (int argc, char **argv);
+int test_forest_file (int argc, char **argv);
 
+/* Without arguments: the random forest prototype
+ * --svm-file <feature file> [features]: Shogun LibSVM on a DataHandler file
+ * --forest-file <feature file> [features] [bins] [trees]: Shogun random
+ *   forest on quantile binned features of a DataHandler file
+ * --compare <feature file> [features] [C]: Shogun, dlib and the dcd solver
+ *   on the same data
+*/
 int main (int argc, char ** argv)
 {
-    test_random_forest (argc, argv);
+    if (argc > 2 && std::string (argv[1]) == "--svm-file")
+        return test_svm_file (argc - 1, argv + 1);
+    if (argc > 2 && std::string (argv[1]) == "--forest-file")
+        return test_forest_file (argc - 1, argv + 1);
+    if (argc > 2 && std::string (argv[1]) == "--compare")
+        return compare_linear (argc - 1, argv + 1);
+    return test_random_forest (argc, argv);
+}
+
+/// Features listed in 's' ("1,3,4"), all 'n' if it is NULL
+vec<size_t> parseFeatures (const char *s, size_t n)
+{
+    vec<size_t> f;
+    if (s == NULL)
+    {
+        for (size_t j = 0; j < n; j++)
+            f.push_back (j);
+        return f;
+    }
+    std::stringstream ss (s);
+    Str_t item;
+    while (std::getline (ss, item, ','))
+        f.push_back (std::stoul (item) - 1);
+    return f;
+}
+
+double msSince (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli> (
+           std::chrono::steady_clock::now () - start).count ();
+}
+
+/* Linear SVMs of Shogun (LibLinear, dual L1-loss), dlib (cutting plane) and
+ * the dlibSVM dual coordinate descent solver on one feature file read by
+ * DataHandler (half for training), at the same C (argv[3], default 1) and
+ * on the features listed in argv[2]. Shogun and the dcd solver train on the
+ * same row-major matrix, Shogun through a zero-copy view (see
+ * shogunconverter.h); dlib needs a vector of its own sample matrices, which
+ * is copied from it (timed separately). Prints time and test accuracy.
+*/
+int compare_linear (int argc, char **argv)
+{
+    init_shogun(&print_message);
+    get_global_parallel()->set_num_threads(TaskPool::instance ().threads ());
+
+    DataHandler dh (argv[1], 0.5);
+    const vecS_t &train = dh.getTrainSetConst ();
+    const vecS_t &test = dh.getTestSetConst ();
+    vec<size_t> f = parseFeatures ((argc > 2) ? argv[2] : NULL, train[0].size ());
+    double C = (argc > 3) ? std::stod (argv[3]) : 1.0;
+    FeatureMatrix trainMat, testMat;
+    vec<label_t> trainLab, testLab;
+    dataHandlerToRowMajor (train, f, trainMat);
+    dataHandlerToRowMajor (test, f, testMat);
+    dataHandlerLabelsToDlib (train, trainLab);
+    dataHandlerLabelsToDlib (test, testLab);
+    auto accuracy = [&] (const vecD &scores)
+    {
+        size_t correct = 0;
+        for (size_t i = 0; i < scores.size (); i++)
+            correct += (scores[i] > 0) == (testLab[i] > 0);
+        return correct / (double) scores.size ();
+    };
+    vecD scores (testMat.rows ());
+    printf ("%-10s %12s %12s %12s\n", "learner", "copy (ms)", "train (ms)", "accuracy");
+
+    // Shogun on the shared matrix
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    CDenseFeatures<feature_t> *trainF = rowMajorToShogunFeatures (trainMat);
+    CDenseFeatures<feature_t> *testF = rowMajorToShogunFeatures (testMat);
+    SG_REF(trainF);
+    SG_REF(testF);
+    double copyMs = msSince (start);
+    CBinaryLabels* labels = dataHandlerLabelsToShogun (train);
+    start = std::chrono::steady_clock::now ();
+    CLibLinear* ll = new CLibLinear(C, trainF, labels);
+    ll->set_liblinear_solver_type(L2R_L1LOSS_SVC_DUAL);
+    ll->set_bias_enabled(true);
+    ll->train();
+    double trainMs = msSince (start);
+    CBinaryLabels* out = ll->apply_binary(testF);
+    for (size_t i = 0; i < scores.size (); i++)
+        scores[i] = out->get_value (i);
+    printf ("%-10s %12.2f %12.2f %12.4f\n", "shogun", copyMs, trainMs, accuracy (scores));
+    SG_UNREF(out);
+    SG_UNREF(ll);
+    SG_UNREF(trainF);
+    SG_UNREF(testF);
+
+    // dlib on copies of the rows
+    typedef dlib::matrix<double, 0, 1> sample_type;
+    start = std::chrono::steady_clock::now ();
+    vec<sample_type> samples (trainMat.rows ());
+    for (size_t i = 0; i < trainMat.rows (); i++)
+    {
+        samples[i].set_size (trainMat.cols ());
+        for (size_t j = 0; j < trainMat.cols (); j++)
+            samples[i](j) = trainMat(i, j);
+    }
+    copyMs = msSince (start);
+    start = std::chrono::steady_clock::now ();
+    dlib::svm_c_linear_trainer<dlib::linear_kernel<sample_type> > tr;
+    tr.set_c (C);
+    dlib::decision_function<dlib::linear_kernel<sample_type> > df = tr.train (samples, trainLab);
+    trainMs = msSince (start);
+    sample_type x;
+    x.set_size (testMat.cols ());
+    for (size_t i = 0; i < scores.size (); i++)
+    {
+        for (size_t j = 0; j < testMat.cols (); j++)
+            x(j) = testMat(i, j);
+        scores[i] = df (x);
+    }
+    printf ("%-10s %12.2f %12.2f %12.4f\n", "dlib", copyMs, trainMs, accuracy (scores));
+
+    // dcd solver on the shared matrix
+    start = std::chrono::steady_clock::now ();
+    DCDSolver dcd;
+    dcd.setC (C);
+    dcd.train (trainMat, trainLab);
+    trainMs = msSince (start);
+    for (size_t i = 0; i < scores.size (); i++)
+        scores[i] = dcd.predict (testMat.row (i));
+    printf ("%-10s %12.2f %12.2f %12.4f\n", "dcd", 0.0, trainMs, accuracy (scores));
+
+    exit_shogun();
+    return 0;
+}
+
+/* Shogun LibSVM on a feature file read by DataHandler (half for training),
+ * optionally on the features listed in argv[2] ("1,3,4"). The features are
+ * shared with DataHandler's row-major copy, see shogunconverter.h.
+*/
+int test_svm_file (int argc, char **argv)
+{
+    init_shogun(&print_message);
+    // Shogun runs its own threads, give it as many as the task pool has
+    // instead of adding them on top
+    get_global_parallel()->set_num_threads(TaskPool::instance ().threads ());
+
+    DataHandler dh (argv[1], 0.5);
+    const vecS_t &train = dh.getTrainSetConst ();
+    const vecS_t &test = dh.getTestSetConst ();
+    vec<size_t> all = parseFeatures (NULL, train[0].size ());
+    vec<size_t> f = parseFeatures ((argc > 2) ? argv[2] : NULL, all.size ());
+
+    FeatureMatrix trainMat, testMat;
+    dataHandlerToRowMajor (train, all, trainMat);
+    dataHandlerToRowMajor (test, all, testMat);
+    CDenseFeatures<feature_t> *trainAll = rowMajorToShogunFeatures (trainMat);
+    CDenseFeatures<feature_t> *testAll = rowMajorToShogunFeatures (testMat);
+    CDenseSubsetFeatures<feature_t> *trainF = shogunFeatureSubset (trainAll, f);
+    CDenseSubsetFeatures<feature_t> *testF = shogunFeatureSubset (testAll, f);
+    SG_REF(trainF);
+    SG_REF(testF);
+
+    CBinaryLabels* labels = dataHandlerLabelsToShogun (train);
+    CGaussianKernel* kernel = new CGaussianKernel(10, 0.5);
+    kernel->init(trainF, trainF);
+    CLibSVM* svm = new CLibSVM(10, kernel, labels);
+    svm->train();
+
+    CBinaryLabels* out = svm->apply_binary(testF);
+    size_t correct = 0;
+    for (size_t i = 0; i < test.size (); i++)
+        correct += (out->get_label (i) > 0) == (test[i].getLabel () > 0);
+    SG_SPRINT("test accuracy: %f\n", correct / (double) test.size ());
+
+    // free up memory, the Shogun objects before the matrices they view
+    SG_UNREF(out);
+    SG_UNREF(svm);
+    SG_UNREF(trainF);
+    SG_UNREF(testF);
+
+    exit_shogun();
+    return 0;
+}
+
+/// Features 'f' of 'x' replaced by their bin, the number of edges of
+/// edges[k] at or below the value, one sample per column (owned by Shogun)
+SGMatrix<float64_t> binnedFeatures (const vecS_t &x, const vec<size_t> &f,
+                                    const vec<vecD_t> &edges)
+{
+    SGMatrix<float64_t> m ((index_t) f.size (), (index_t) x.size ());
+    for (size_t i = 0; i < x.size (); i++)
+        for (size_t k = 0; k < f.size (); k++)
+            m.matrix[i * f.size () + k] = std::upper_bound (edges[k].begin (), edges[k].end (),
+                                                            x[i][f[k]]) - edges[k].begin ();
+    return m;
+}
+
+/* Shogun random forest on a feature file read by DataHandler (half for
+ * training), on the features listed in argv[2] (all without it or with
+ * "all"). Every feature is binned into argv[3] (default 32) equal-frequency
+ * bins, with the edges from quantile sketches of the training set (see
+ * FeatureQuantiles::binEdges): the trees only try the bin boundaries as
+ * split points instead of every distinct value. argv[4] trees (default 50).
+*/
+int test_forest_file (int argc, char **argv)
+{
+    init_shogun(&print_message);
+    get_global_parallel()->set_num_threads(TaskPool::instance ().threads ());
+
+    DataHandler dh (argv[1], 0.5);
+    const vecS_t &train = dh.getTrainSetConst ();
+    const vecS_t &test = dh.getTestSetConst ();
+    bool all = argc <= 2 || std::string (argv[2]) == "all";
+    vec<size_t> f = parseFeatures (all ? NULL : argv[2], train[0].size ());
+    uint nbins = (argc > 3) ? std::stoul (argv[3]) : 32;
+    int32_t trees = (argc > 4) ? std::stoi (argv[4]) : 50;
+
+    FeatureQuantiles q;
+    for (size_t i = 0; i < train.size (); i++)
+        q.add (train[i].getFeatures (), train[i].getWeight ());
+    vec<vecD_t> edges (f.size ());
+    for (size_t k = 0; k < f.size (); k++)
+        q.binEdges (f[k], nbins, edges[k]);
+    CDenseFeatures<float64_t> *trainF = new CDenseFeatures<float64_t> (binnedFeatures (train, f, edges));
+    CDenseFeatures<float64_t> *testF = new CDenseFeatures<float64_t> (binnedFeatures (test, f, edges));
+    SG_REF(trainF);
+    SG_REF(testF);
+
+    CMulticlassLabels* labels = new CMulticlassLabels ((int32_t) train.size ());
+    for (size_t i = 0; i < train.size (); i++)
+        labels->set_label ((int32_t) i, train[i].getLabel () > 0 ? 1 : 0);
+    // Bins are ordered, the trees treat them as continuous
+    SGVector<bool> nominal ((index_t) f.size ());
+    for (size_t k = 0; k < f.size (); k++)
+        nominal[k] = false;
+    CRandomForest* forest = new CRandomForest (
+        std::max (1, (int32_t) std::sqrt ((double) f.size ())), trees);
+    forest->set_labels (labels);
+    forest->set_feature_types (nominal);
+    forest->set_combination_rule (new CMajorityVote ());
+    forest->set_machine_problem_type (PT_MULTICLASS);
+    forest->train (trainF);
+
+    CMulticlassLabels* out = forest->apply_multiclass (testF);
+    size_t correct = 0;
+    for (size_t i = 0; i < test.size (); i++)
+        correct += (out->get_label (i) > 0) == (test[i].getLabel () > 0);
+    SG_SPRINT("test accuracy: %f\n", correct / (double) test.size ());
+
+    SG_UNREF(out);
+    SG_UNREF(forest);
+    SG_UNREF(trainF);
+    SG_UNREF(testF);
+
+    exit_shogun();
+    return 0;
 }
 
 int test_random_forest(int argc, char** argv)